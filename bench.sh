@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+# bench.sh: Measure the speed of xcd's various output modes.
+#
+# Usage: bench.sh [XCD [SIZE]]
+#
+# Representative inputs of SIZE megabytes (default 16) are generated
+# in a temporary directory, and each one is dumped in each mode, with
+# the output going both directly to /dev/null and through a pipe. The
+# throughput of each run is reported in megabytes and lines per
+# second. XCD defaults to the xcd alongside this script, and the text
+# input is made from the source files found there.
+
+src=$(dirname "$0")
+xcd=${1:-$src/xcd}
+size=${2:-16}
+dir=$(mktemp -d "${TMPDIR:-/tmp}/xcdbench.XXXXXX") || exit 1
+trap 'rm -rf "$dir"' EXIT
+trap 'exit 1' HUP INT TERM
+
+export TERM=${BENCHTERM:-xterm-256color}
+
+# Generate the inputs.
+
+head -c ${size}M /dev/urandom > "$dir/random"
+: > "$dir/text"
+while [ $(wc -c < "$dir/text") -lt $((size * 1048576)) ] ; do
+    before=$(wc -c < "$dir/text")
+    cat "$src/xcd.c" "$src/README" "$src/LICENSE" >> "$dir/text" || exit 1
+    if [ $(wc -c < "$dir/text") -le $before ] ; then
+        echo "bench.sh: no text input in $src" >&2
+        exit 1
+    fi
+done
+truncate -s ${size}M "$dir/text"
+{ head -c $((size * 64))K /dev/urandom ; head -c $((size * 960))K /dev/zero ; } \
+    > "$dir/mostlyzero"
+head -c 1M /dev/urandom > "$dir/sparse"
+truncate -s $((size * 64))M "$dir/sparse"
+mkdir "$dir/small"
+i=0
+while [ $i -lt 500 ] ; do
+    head -c 4096 "$dir/random" > "$dir/small/f$i"
+    i=$((i + 1))
+done
+smallsize=$((500 * 4096))
+
+# Run one benchmark. The arguments are a label, the number of bytes
+# dumped, the bytes per line, and the command line that follows xcd.
+
+run()
+{
+    label=$1 bytes=$2 count=$3
+    shift 3
+    for dest in null pipe ; do
+        t0=$(date +%s%N)
+        if [ $dest = null ] ; then
+            "$xcd" "$@" > /dev/null
+        else
+            "$xcd" "$@" | cat > /dev/null
+        fi
+        t1=$(date +%s%N)
+        awk -v l="$label" -v d=$dest -v b=$bytes -v c=$count \
+            -v t=$((t1 - t0)) 'BEGIN {
+                s = t / 1e9 ; if (s <= 0) s = 1e-9
+                printf "%-28s %-4s %8.1f MB/s %12.0f lines/s\n",
+                       l, d, b / 1048576 / s, b / c / s
+            }'
+    done
+}
+
+bytes=$((size * 1048576))
+for input in random text mostlyzero ; do
+    run "$input -N"             $bytes 16 -N "$dir/$input"
+    run "$input color"          $bytes 16 "$dir/$input"
+    run "$input -R"             $bytes 16 -R "$dir/$input"
+    run "$input -a"             $bytes 16 -a "$dir/$input"
+    run "$input -N -c32 -g4"    $bytes 32 -N -c32 -g4 "$dir/$input"
+    run "$input -c8 -g1"        $bytes 8 -c8 -g1 "$dir/$input"
+    run "$input --threads=0"    $bytes 16 --threads=0 "$dir/$input"
+done
+run "sparse -a"                 $((size * 64 * 1048576)) 16 -a "$dir/sparse"
+run "small files -N"            $smallsize 16 -N "$dir"/small/*
+run "small files color"         $smallsize 16 "$dir"/small/*
+run "small files --output-dir"  $smallsize 16 --output-dir="$dir/out" "$dir"/small/*
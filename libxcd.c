@@ -0,0 +1,1155 @@
+/*
+ * libxcd.c: The rendering core of xcd.
+ *
+ * Copyright (C) 2018 Brian Raiter <breadbox@muppetlabs.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#if defined __x86_64__ || defined __i386__
+#include <immintrin.h>
+#elif defined __aarch64__
+#include <arm_neon.h>
+#endif
+#include "libxcd.h"
+
+typedef unsigned char byte;
+
+/* The digits used to display values in hexadecimal.
+ */
+static char const hexdigits[] = "0123456789ABCDEF";
+
+/* A line's worth of zero bytes.
+ */
+static byte const zeroline[256];
+
+/* The color index palette. This is the list of color indexes for the
+ * 256-color xterm, sorted to maximize visual contrast. Colors should
+ * be assigned preferentially from the start of this list.
+ *
+ * To create this index, high-contrast color sets created by design
+ * researchers were consulted. References to their papers can be found
+ * at <https://graphicdesign.stackexchange.com/a/3815>. The Kenneth
+ * Kelly palette was the main source, with some modifications (such as
+ * reserving black and other colors often used for normal text). The
+ * resulting list of colors was then matched with entries the xterm
+ * palette, as close as possible. Finally, the remaining colors in the
+ * xterm palette were added, sorted by their color-space distance from
+ * each other, but skipping over ones that were too dark to read on a
+ * black background. Finally, the last two colors are repeated to fill
+ * out the palette to 256 entries.
+ */
+static byte const colorset[] = {
+      8,  /* #808080 */
+     11,  /* #FFFF00 */
+     53,  /* #5F005F */
+    202,  /* #FF5F00 */
+     87,  /* #5FFFFF */
+      9,  /* #FF0000 */
+     41,  /* #00D75F */
+    217,  /* #FFAFAF */
+     32,  /* #0087D7 */
+    222,  /* #FFD787 */
+     57,  /* #5F00FF */
+    214,  /* #FFAF00 */
+    126,  /* #AF0087 */
+    191,  /* #D7FF5F */
+     88,  /* #870000 */
+    148,  /* #AFD700 */
+     94,  /* #875F00 */
+    219,  /* #FFAFFF */
+     22,  /* #005F00 */
+    228,  /* #FFFF87 */
+    121,  /* #87FFAF */
+      4,  /* #000080 */
+      3,  /* #808000 */
+     23,  /* #005F5F */
+     30,  /* #008787 */
+    179,  /* #D7AF5F */
+     14,  /* #00FFFF */
+     13,  /* #FF00FF */
+    195,  /* #D7FFFF */
+     12,  /* #0000FF */
+    225,  /* #FFD7FF */
+    123,  /* #87FFFF */
+    230,  /* #FFFFD7 */
+     27,  /* #005FFF */
+    159,  /* #AFFFFF */
+     10,  /* #00FF00 */
+    207,  /* #FF5FFF */
+    165,  /* #D700FF */
+     50,  /* #00FFD7 */
+    227,  /* #FFFF5F */
+    235,  /* #262626 */
+    200,  /* #FF00D7 */
+     45,  /* #00D7FF */
+     82,  /* #5FFF00 */
+    213,  /* #FF87FF */
+    197,  /* #FF005F */
+     47,  /* #00FF5F */
+    255,  /* #EEEEEE */
+     20,  /* #0000D7 */
+    190,  /* #D7FF00 */
+     93,  /* #8700FF */
+    229,  /* #FFFFAF */
+    236,  /* #303030 */
+     33,  /* #0087FF */
+    220,  /* #FFD700 */
+    129,  /* #AF00FF */
+     49,  /* #00FFAF */
+    160,  /* #D70000 */
+     39,  /* #00AFFF */
+    198,  /* #FF0087 */
+    118,  /* #87FF00 */
+    199,  /* #FF00AF */
+     48,  /* #00FF87 */
+    208,  /* #FF8700 */
+     63,  /* #5F5FFF */
+    154,  /* #AFFF00 */
+     81,  /* #5FD7FF */
+     52,  /* #5F0000 */
+    171,  /* #D75FFF */
+    194,  /* #D7FFD7 */
+     17,  /* #00005F */
+    224,  /* #FFD7D7 */
+     40,  /* #00D700 */
+    206,  /* #FF5FD7 */
+     86,  /* #5FFFD7 */
+    237,  /* #3A3A3A */
+    189,  /* #D7D7FF */
+    203,  /* #FF5F5F */
+     83,  /* #5FFF5F */
+     19,  /* #0000AF */
+    254,  /* #E4E4E4 */
+      1,  /* #800000 */
+    221,  /* #FFD75F */
+    177,  /* #D787FF */
+      2,  /* #008000 */
+    117,  /* #87D7FF */
+     18,  /* #000087 */
+    158,  /* #AFFFD7 */
+    212,  /* #FF87D7 */
+    124,  /* #AF0000 */
+    183,  /* #D7AFFF */
+     28,  /* #008700 */
+    122,  /* #87FFD7 */
+    204,  /* #FF5F87 */
+     34,  /* #00AF00 */
+    153,  /* #AFD7FF */
+    193,  /* #D7FFAF */
+     69,  /* #5F87FF */
+    205,  /* #FF5FAF */
+     84,  /* #5FFF87 */
+    238,  /* #444444 */
+    218,  /* #FFAFD7 */
+    192,  /* #D7FF87 */
+     99,  /* #875FFF */
+    119,  /* #87FF5F */
+    135,  /* #AF5FFF */
+    209,  /* #FF875F */
+     75,  /* #5FAFFF */
+    223,  /* #FFD7AF */
+     85,  /* #5FFFAF */
+    215,  /* #FFAF5F */
+     56,  /* #5F00D7 */
+    155,  /* #AFFF5F */
+    164,  /* #D700D7 */
+     58,  /* #5F5F00 */
+     44,  /* #00D7D7 */
+    161,  /* #D7005F */
+    184,  /* #D7D700 */
+     26,  /* #005FD7 */
+     76,  /* #5FD700 */
+    105,  /* #8787FF */
+    166,  /* #D75F00 */
+    120,  /* #87FF87 */
+    141,  /* #AF87FF */
+    210,  /* #FF8787 */
+    239,  /* #4E4E4E */
+    111,  /* #87AFFF */
+    156,  /* #AFFF87 */
+    211,  /* #FF87AF */
+    147,  /* #AFAFFF */
+    216,  /* #FFAF87 */
+    157,  /* #AFFFAF */
+     92,  /* #8700D7 */
+     42,  /* #00D787 */
+    162,  /* #D70087 */
+     38,  /* #00AFD7 */
+    112,  /* #87D700 */
+    163,  /* #D700AF */
+     43,  /* #00D7AF */
+    172,  /* #D78700 */
+    128,  /* #AF00D7 */
+     29,  /* #00875F */
+    253,  /* #DADADA */
+     54,  /* #5F0087 */
+    178,  /* #D7AF00 */
+     24,  /* #005F87 */
+     55,  /* #5F00AF */
+     64,  /* #5F8700 */
+    188,  /* #D7D7D7 */
+     89,  /* #87005F */
+     35,  /* #00AF5F */
+     25,  /* #005FAF */
+    130,  /* #AF5F00 */
+     80,  /* #5FD7D7 */
+    125,  /* #AF005F */
+     70,  /* #5FAF00 */
+    170,  /* #D75FD7 */
+    185,  /* #D7D75F */
+    240,  /* #585858 */
+    252,  /* #D0D0D0 */
+     62,  /* #5F5FD7 */
+     77,  /* #5FD75F */
+      5,  /* #800080 */
+    167,  /* #D75F5F */
+    152,  /* #AFD7D7 */
+      6,  /* #008080 */
+    182,  /* #D7AFD7 */
+     37,  /* #00AFAF */
+    187,  /* #D7D7AF */
+     91,  /* #8700AF */
+    142,  /* #AFAF00 */
+    116,  /* #87D7D7 */
+    136,  /* #AF8700 */
+    176,  /* #D787D7 */
+     31,  /* #0087AF */
+    186,  /* #D7D787 */
+     90,  /* #870087 */
+    106,  /* #87AF00 */
+    127,  /* #AF00AF */
+     36,  /* #00AF87 */
+    100,  /* #878700 */
+    251,  /* #C6C6C6 */
+     59,  /* #5F5F5F */
+     74,  /* #5FAFD7 */
+    134,  /* #AF5FD7 */
+     79,  /* #5FD7AF */
+    149,  /* #AFD75F */
+    169,  /* #D75FAF */
+    241,  /* #626262 */
+     68,  /* #5F87D7 */
+    113,  /* #87D75F */
+    168,  /* #D75F87 */
+     78,  /* #5FD787 */
+     98,  /* #875FD7 */
+    173,  /* #D7875F */
+      7,  /* #C0C0C0 */
+    242,  /* #6C6C6C */
+    146,  /* #AFAFD7 */
+     61,  /* #5F5FAF */
+    151,  /* #AFD7AF */
+     71,  /* #5FAF5F */
+    131,  /* #AF5F5F */
+    181,  /* #D7AFAF */
+     60,  /* #5F5F87 */
+    110,  /* #87AFD7 */
+    150,  /* #AFD787 */
+    175,  /* #D787AF */
+     65,  /* #5F875F */
+    115,  /* #87D7AF */
+    140,  /* #AF87D7 */
+    180,  /* #D7AF87 */
+     95,  /* #875F5F */
+    104,  /* #8787D7 */
+    114,  /* #87D787 */
+    174,  /* #D78787 */
+    250,  /* #BCBCBC */
+    243,  /* #767676 */
+     73,  /* #5FAFAF */
+    133,  /* #AF5FAF */
+    143,  /* #AFAF5F */
+     67,  /* #5F87AF */
+    107,  /* #87AF5F */
+    132,  /* #AF5F87 */
+     72,  /* #5FAF87 */
+     97,  /* #875FAF */
+    137,  /* #AF875F */
+     66,  /* #5F8787 */
+     96,  /* #875F87 */
+    101,  /* #87875F */
+    249,  /* #B2B2B2 */
+    145,  /* #AFAFAF */
+    248,  /* #A8A8A8 */
+    109,  /* #87AFAF */
+    139,  /* #AF87AF */
+    144,  /* #AFAF87 */
+    247,  /* #9E9E9E */
+    103,  /* #8787AF */
+    108,  /* #87AF87 */
+    138,  /* #AF8787 */
+    246,  /* #949494 */
+    245,  /* #8A8A8A */
+    102,  /* #878787 */
+    245,  /* #8A8A8A */
+    102,  /* #878787 */
+    245,  /* #8A8A8A */
+    102,  /* #878787 */
+    245,  /* #8A8A8A */
+    102,  /* #878787 */
+    245,  /* #8A8A8A */
+    102,  /* #878787 */
+    245,  /* #8A8A8A */
+    102,  /* #878787 */
+    245,  /* #8A8A8A */
+    102,  /* #878787 */
+    245,  /* #8A8A8A */
+    102,  /* #878787 */
+};
+
+/*
+ * Internal functions.
+ */
+
+/* Store the representation of the given character used in the text
+ * column, and return its length. Latin-1 and Unicode control pictures
+ * are used to represent non-ASCII and control characters, unless
+ * unicode is false.
+ */
+static int getbyterepresentation(char *buf, byte ch, int unicode)
+{
+    if (!unicode) {
+        buf[0] = isprint(ch) ? ch : '.';
+        return 1;
+    }
+    if (ch < 32) {
+        buf[0] = 0xE2;
+        buf[1] = 0x90;
+        buf[2] = 0x80 | ch;
+        return 3;
+    } else if (ch == 32) {
+        buf[0] = 0xE2;
+        buf[1] = 0x90;
+        buf[2] = 0xA0;
+        return 3;
+    } else if (ch < 127) {
+        buf[0] = ch;
+        return 1;
+    } else if (ch == 127) {
+        buf[0] = 0xE2;
+        buf[1] = 0x90;
+        buf[2] = 0xA1;
+        return 3;
+    } else if (ch < 160) {
+        buf[0] = 0xE2;
+        buf[1] = 0x90;
+        buf[2] = 0xA6;
+        return 3;
+    } else if (ch == 160) {
+        buf[0] = 0xE2;
+        buf[1] = 0x90;
+        buf[2] = 0xA3;
+        return 3;
+    } else {
+        buf[0] = 0xC0 | (ch >> 6);
+        buf[1] = 0x80 | (ch & 0x3F);
+        return 2;
+    }
+}
+
+/* Return true if the given byte value is displayed in color.
+ */
+static int iscolored(xcdcontext const *ctx, int ch)
+{
+    return !(ctx->flags & XCD_RAW) || isgraph(ch);
+}
+
+/* Compute the largest number of bytes that the rendering of a single
+ * line of input can produce. The extra sixteen bytes at each end
+ * allow for the address, and for the fixed-size copies done when
+ * encoding hex digits. Each byte can be preceded by one control
+ * sequence, which when highlighting differences may be sgr0.
+ */
+static void setmaxlinesize(xcdcontext *ctx)
+{
+    int maxseqlen, i;
+
+    ctx->maxlinesize = 16 + 2 + ctx->hexwidth + 2 + 4 * ctx->linesize
+                          + 1 + 16;
+    if (ctx->flags & XCD_NOCOLOR)
+        return;
+    maxseqlen = 0;
+    for (i = 0 ; i < 256 ; ++i)
+        if (maxseqlen < ctx->colorseqlens[i])
+            maxseqlen = ctx->colorseqlens[i];
+    if (maxseqlen < ctx->sgr0len)
+        maxseqlen = ctx->sgr0len;
+    ctx->maxlinesize += 3 * ctx->sgr0len + 2 * ctx->linesize * maxseqlen;
+}
+
+/*
+ * Hexadecimal encoding.
+ */
+
+/* Encode count bytes as pairs of hexadecimal digits, one byte at a
+ * time.
+ */
+static void hexencodescalar(char *out, byte const *in, int count)
+{
+    int i;
+
+    for (i = 0 ; i < count ; ++i) {
+        out[2 * i] = hexdigits[in[i] >> 4];
+        out[2 * i + 1] = hexdigits[in[i] & 15];
+    }
+}
+
+#if defined __SSE2__
+
+/* Encode count bytes as pairs of hexadecimal digits, sixteen bytes at
+ * a time. Each byte is split into its two nibbles, which are then
+ * interleaved and mapped onto the digit characters.
+ */
+static void hexencodesse2(char *out, byte const *in, int count)
+{
+    __m128i const mask = _mm_set1_epi8(0x0F);
+    __m128i const nine = _mm_set1_epi8(9);
+    __m128i const zero = _mm_set1_epi8('0');
+    __m128i const gap = _mm_set1_epi8('A' - '0' - 10);
+    __m128i v, hi, lo, a, b;
+    int i;
+
+    for (i = 0 ; i + 16 <= count ; i += 16) {
+        v = _mm_loadu_si128((__m128i const*)(in + i));
+        hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+        lo = _mm_and_si128(v, mask);
+        a = _mm_unpacklo_epi8(hi, lo);
+        b = _mm_unpackhi_epi8(hi, lo);
+        a = _mm_add_epi8(_mm_add_epi8(a, zero),
+                         _mm_and_si128(_mm_cmpgt_epi8(a, nine), gap));
+        b = _mm_add_epi8(_mm_add_epi8(b, zero),
+                         _mm_and_si128(_mm_cmpgt_epi8(b, nine), gap));
+        _mm_storeu_si128((__m128i*)(out + 2 * i), a);
+        _mm_storeu_si128((__m128i*)(out + 2 * i + 16), b);
+    }
+    hexencodescalar(out + 2 * i, in + i, count - i);
+}
+
+#endif
+
+#if (defined __x86_64__ || defined __i386__) && defined __GNUC__
+#define HAVE_AVX2_KERNEL
+
+/* Encode count bytes as pairs of hexadecimal digits, thirty-two bytes
+ * at a time. This is the same algorithm as the SSE2 version, with an
+ * extra step to undo the lane-wise interleaving of the AVX2 unpack
+ * instructions.
+ */
+__attribute__((target("avx2")))
+static void hexencodeavx2(char *out, byte const *in, int count)
+{
+    __m256i const mask = _mm256_set1_epi8(0x0F);
+    __m256i const nine = _mm256_set1_epi8(9);
+    __m256i const zero = _mm256_set1_epi8('0');
+    __m256i const gap = _mm256_set1_epi8('A' - '0' - 10);
+    __m256i v, hi, lo, a, b;
+    int i;
+
+    for (i = 0 ; i + 32 <= count ; i += 32) {
+        v = _mm256_loadu_si256((__m256i const*)(in + i));
+        hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), mask);
+        lo = _mm256_and_si256(v, mask);
+        a = _mm256_unpacklo_epi8(hi, lo);
+        b = _mm256_unpackhi_epi8(hi, lo);
+        a = _mm256_add_epi8(_mm256_add_epi8(a, zero),
+                            _mm256_and_si256(_mm256_cmpgt_epi8(a, nine), gap));
+        b = _mm256_add_epi8(_mm256_add_epi8(b, zero),
+                            _mm256_and_si256(_mm256_cmpgt_epi8(b, nine), gap));
+        _mm256_storeu_si256((__m256i*)(out + 2 * i),
+                            _mm256_permute2x128_si256(a, b, 0x20));
+        _mm256_storeu_si256((__m256i*)(out + 2 * i + 32),
+                            _mm256_permute2x128_si256(a, b, 0x31));
+    }
+    hexencodescalar(out + 2 * i, in + i, count - i);
+}
+
+#endif
+
+#if defined __aarch64__
+
+/* Encode count bytes as pairs of hexadecimal digits, sixteen bytes at
+ * a time, using a table lookup for the digits and an interleaving
+ * store to pair them up.
+ */
+static void hexencodeneon(char *out, byte const *in, int count)
+{
+    uint8x16_t const digits = vld1q_u8((byte const*)"0123456789ABCDEF");
+    uint8x16x2_t pair;
+    uint8x16_t v;
+    int i;
+
+    for (i = 0 ; i + 16 <= count ; i += 16) {
+        v = vld1q_u8(in + i);
+        pair.val[0] = vqtbl1q_u8(digits, vshrq_n_u8(v, 4));
+        pair.val[1] = vqtbl1q_u8(digits, vandq_u8(v, vdupq_n_u8(0x0F)));
+        vst2q_u8((byte*)out + 2 * i, pair);
+    }
+    hexencodescalar(out + 2 * i, in + i, count - i);
+}
+
+#endif
+
+/* Select the fastest hexadecimal encoder that the CPU supports.
+ */
+static void inithexencode(xcdcontext *ctx)
+{
+    ctx->hexencode = hexencodescalar;
+#if defined __SSE2__
+    ctx->hexencode = hexencodesse2;
+#endif
+#if defined HAVE_AVX2_KERNEL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        ctx->hexencode = hexencodeavx2;
+#endif
+#if defined __aarch64__
+    ctx->hexencode = hexencodeneon;
+#endif
+}
+
+/*
+ * Initialization.
+ */
+
+static void initrender(xcdcontext *ctx);
+
+/* Set up a context, with the byte representation tables and the
+ * default control sequences.
+ */
+int xcd_init(xcdcontext *ctx, int linesize, int groupsize, int flags)
+{
+    int i;
+
+    if (linesize < 1 || linesize > 256 || groupsize < 0)
+        return -1;
+    memset(ctx, 0, sizeof *ctx);
+    ctx->linesize = linesize;
+    ctx->groupsize = groupsize ? groupsize : linesize;
+    ctx->addrwidth = 8;
+    ctx->flags = flags;
+    if (flags & XCD_RAW)
+        ctx->flags &= ~(XCD_NOCOLOR | XCD_AUTOSKIP);
+    ctx->hexwidth = 2 * linesize
+                  + (linesize + ctx->groupsize - 1) / ctx->groupsize;
+    inithexencode(ctx);
+    initrender(ctx);
+    for (i = 0 ; i < 256 ; ++i) {
+        ctx->hexcells[i][0] = hexdigits[i >> 4];
+        ctx->hexcells[i][1] = hexdigits[i & 15];
+        ctx->glyphlens[i] = getbyterepresentation(ctx->glyphs[i], i,
+                                                  !(flags & XCD_ASCII));
+    }
+    for (i = 0 ; i < 256 ; ++i) {
+        if (i < 8)
+            ctx->colorseqlens[i] = sprintf(ctx->colorseqs[i],
+                                           "\33[3%dm", i);
+        else if (i < 16)
+            ctx->colorseqlens[i] = sprintf(ctx->colorseqs[i],
+                                           "\33[9%dm", i - 8);
+        else
+            ctx->colorseqlens[i] = sprintf(ctx->colorseqs[i],
+                                           "\33[38;5;%dm", i);
+    }
+    ctx->sgr0len = sprintf(ctx->sgr0, "\33(B\33[m");
+    setmaxlinesize(ctx);
+    xcd_reset(ctx);
+    return 0;
+}
+
+/* Discard the colors assigned and any zero lines held back.
+ */
+void xcd_reset(xcdcontext *ctx)
+{
+    int i;
+
+    memset(ctx->palette, 0, sizeof ctx->palette);
+    ctx->palette[0] = colorset[0];
+    ctx->nextcolorfromset = 1;
+    ctx->colorsleft = 0;
+    if (!(ctx->flags & XCD_NOCOLOR))
+        for (i = 1 ; i < 256 ; ++i)
+            if (iscolored(ctx, i))
+                ++ctx->colorsleft;
+    ctx->zerolines = 0;
+    ctx->zeropos = 0;
+    ctx->zerosize = 0;
+}
+
+/* Change the minimum width of the address.
+ */
+void xcd_setaddrwidth(xcdcontext *ctx, int addrwidth)
+{
+    ctx->addrwidth = addrwidth < 1 ? 1 : addrwidth > 16 ? 16 : addrwidth;
+}
+
+/* Copy in a new set of control sequences.
+ */
+int xcd_setcolorseqs(xcdcontext *ctx, char const *const *colorseqs,
+                     char const *sgr0)
+{
+    int i;
+
+    for (i = 0 ; i < 256 ; ++i)
+        if (strlen(colorseqs[i]) >= XCD_MAXSEQLEN)
+            return -1;
+    if (strlen(sgr0) >= XCD_MAXSEQLEN)
+        return -1;
+    for (i = 0 ; i < 256 ; ++i) {
+        ctx->colorseqlens[i] = strlen(colorseqs[i]);
+        memcpy(ctx->colorseqs[i], colorseqs[i], ctx->colorseqlens[i] + 1);
+    }
+    ctx->sgr0len = strlen(sgr0);
+    memcpy(ctx->sgr0, sgr0, ctx->sgr0len + 1);
+    setmaxlinesize(ctx);
+    return 0;
+}
+
+/*
+ * Color assignment.
+ */
+
+/* Assign colors in order of appearance. This is done before a line is
+ * rendered, so that the renderers can use the palette without
+ * checking or modifying it.
+ */
+void xcd_assigncolors(xcdcontext *ctx, void const *buf, int count)
+{
+    byte const *p = buf;
+    int i;
+
+    for (i = 0 ; i < count && ctx->colorsleft ; ++i) {
+        if (!ctx->palette[p[i]] && iscolored(ctx, p[i])) {
+            ctx->palette[p[i]] = colorset[ctx->nextcolorfromset++];
+            --ctx->colorsleft;
+        }
+    }
+}
+
+/* Four separate tallies are kept, so that runs of the same byte value
+ * don't stall on the same counter.
+ */
+void xcd_countbytes(unsigned long long *counts, void const *buf, size_t size)
+{
+    uint32_t tally[4][256];
+    byte const *p = buf;
+    size_t i, n;
+    int ch;
+
+    while (size) {
+        n = size < (1U << 30) ? size : (1U << 30);
+        memset(tally, 0, sizeof tally);
+        for (i = 0 ; i + 4 <= n ; i += 4) {
+            ++tally[0][p[i]];
+            ++tally[1][p[i + 1]];
+            ++tally[2][p[i + 2]];
+            ++tally[3][p[i + 3]];
+        }
+        for ( ; i < n ; ++i)
+            ++tally[0][p[i]];
+        for (ch = 0 ; ch < 256 ; ++ch)
+            counts[ch] += tally[0][ch] + tally[1][ch]
+                        + tally[2][ch] + tally[3][ch];
+        p += n;
+        size -= n;
+    }
+}
+
+/* The most frequently occurring byte values get the colors from the
+ * start of colorset. Ties go to the lower byte value. Zero keeps its
+ * usual color.
+ */
+void xcd_rankcolors(xcdcontext *ctx, unsigned long long const *counts)
+{
+    int best, ch;
+
+    while (ctx->colorsleft) {
+        best = -1;
+        for (ch = 1 ; ch < 256 ; ++ch)
+            if (!ctx->palette[ch] && iscolored(ctx, ch))
+                if (best < 0 || counts[ch] > counts[best])
+                    best = ch;
+        ctx->palette[best] = colorset[ctx->nextcolorfromset++];
+        --ctx->colorsleft;
+    }
+}
+
+/*
+ * Three different dump format functions.
+ */
+
+/* Add the control sequence to change the foreground color to the one
+ * assigned to the given byte value, unless current indicates that it
+ * is already in effect. The return value points past the added bytes.
+ */
+static char *putcolor(xcdcontext const *ctx, char *p, byte ch, int *current)
+{
+    if (ctx->palette[ch] != *current) {
+        *current = ctx->palette[ch];
+        memcpy(p, ctx->colorseqs[*current], ctx->colorseqlens[*current]);
+        p += ctx->colorseqlens[*current];
+    }
+    return p;
+}
+
+/* Add the file position, followed by a colon, in hexadecimal. The
+ * return value points past the added bytes.
+ */
+static char *putaddress(xcdcontext const *ctx, char *p, long long pos)
+{
+    unsigned long long n = pos;
+    int i, w;
+
+    for (w = ctx->addrwidth ; w < 16 && n >> (4 * w) ; ++w) ;
+    for (i = w - 1 ; i >= 0 ; --i, n >>= 4)
+        p[i] = hexdigits[n & 15];
+    p[w] = ':';
+    return p + w + 1;
+}
+
+/* Output colorized bytes directly.
+ */
+static char *renderbytescolored(xcdcontext const *ctx, char *p,
+                                byte const *buf, int count)
+{
+    int color = -1;
+    int ch, i;
+
+    for (i = 0 ; i < count ; ++i) {
+        ch = buf[i];
+        if (!isgraph(ch)) {
+            *p++ = ch;
+            continue;
+        }
+        p = putcolor(ctx, p, ch, &color);
+        memcpy(p, ctx->glyphs[ch], ctx->glyphlens[ch]);
+        p += ctx->glyphlens[ch];
+    }
+    memcpy(p, ctx->sgr0, ctx->sgr0len);
+    return p + ctx->sgr0len;
+}
+
+/* Output one line of data as a hexdump. The hex digits are encoded all
+ * at once, and then copied into place a group at a time using
+ * fixed-size (and thus possibly overlapping) copies.
+ */
+static char *renderlineuncolored(xcdcontext const *ctx, char *p,
+                                 byte const *buf, int count, long long pos)
+{
+    char hex[2 * 256 + 16];
+    int i, j, n, x;
+
+    ctx->hexencode(hex, buf, count);
+    p = putaddress(ctx, p, pos);
+    x = ctx->hexwidth - 2 * count;
+    for (i = 0 ; i < count ; i += ctx->groupsize) {
+        *p++ = ' ';
+        --x;
+        n = 2 * (count - i < ctx->groupsize ? count - i : ctx->groupsize);
+        for (j = 0 ; j < n ; j += 16)
+            memcpy(p + j, hex + 2 * i + j, 16);
+        p += n;
+    }
+    memset(p, ' ', x + 2);
+    p += x + 2;
+    for (i = 0 ; i < count ; ++i) {
+        memcpy(p, ctx->glyphs[buf[i]], 4);
+        p += ctx->glyphlens[buf[i]];
+    }
+    *p++ = '\n';
+    return p;
+}
+
+/* Output one line of data as a hexdump. A color change is only output
+ * when a byte's color differs from the previous byte's.
+ */
+static char *renderlinecolored(xcdcontext const *ctx, char *p,
+                               byte const *buf, int count, long long pos)
+{
+    int color, ch, i, x;
+
+    memcpy(p, ctx->sgr0, ctx->sgr0len);
+    p = putaddress(ctx, p + ctx->sgr0len, pos);
+    color = -1;
+    x = ctx->hexwidth - 2 * count;
+    for (i = 0 ; i < count ; ++i) {
+        if (i % ctx->groupsize == 0) {
+            *p++ = ' ';
+            --x;
+        }
+        ch = buf[i];
+        p = putcolor(ctx, p, ch, &color);
+        memcpy(p, ctx->hexcells[ch], 2);
+        p += 2;
+    }
+    memcpy(p, ctx->sgr0, ctx->sgr0len);
+    p += ctx->sgr0len;
+    memset(p, ' ', x + 2);
+    p += x + 2;
+    color = -1;
+    for (i = 0 ; i < count ; ++i) {
+        ch = buf[i];
+        p = putcolor(ctx, p, ch, &color);
+        memcpy(p, ctx->glyphs[ch], ctx->glyphlens[ch]);
+        p += ctx->glyphlens[ch];
+    }
+    memcpy(p, ctx->sgr0, ctx->sgr0len);
+    p += ctx->sgr0len;
+    *p++ = '\n';
+    return p;
+}
+
+/*
+ * Specialized rendering.
+ */
+
+/* Output one full line of data as an uncolored hexdump, as with
+ * renderlineuncolored(), for a line size and group size that are
+ * known at compile time. Since this is always inlined with constant
+ * sizes, the group copies become single fixed-size moves, the loops
+ * can be unrolled, and the padding disappears.
+ */
+static inline __attribute__((always_inline))
+char *renderfixeduncolored(xcdcontext const *ctx, char *p, byte const *buf,
+                           long long pos, int linesize, int groupsize)
+{
+    char hex[2 * linesize + 16];
+    int i, j;
+
+    ctx->hexencode(hex, buf, linesize);
+    p = putaddress(ctx, p, pos);
+    for (i = 0 ; i < linesize ; i += groupsize) {
+        *p++ = ' ';
+        for (j = 0 ; j < 2 * groupsize ; j += 16)
+            memcpy(p + j, hex + 2 * i + j,
+                   2 * groupsize - j < 16 ? 2 * groupsize - j : 16);
+        p += 2 * groupsize;
+    }
+    memcpy(p, "  ", 2);
+    p += 2;
+    for (i = 0 ; i < linesize ; ++i) {
+        memcpy(p, ctx->glyphs[buf[i]], 4);
+        p += ctx->glyphlens[buf[i]];
+    }
+    *p++ = '\n';
+    return p;
+}
+
+/* Output one full line of data as a colored hexdump, as with
+ * renderlinecolored(), for sizes known at compile time.
+ */
+static inline __attribute__((always_inline))
+char *renderfixedcolored(xcdcontext const *ctx, char *p, byte const *buf,
+                         long long pos, int linesize, int groupsize)
+{
+    int color, ch, i;
+
+    memcpy(p, ctx->sgr0, ctx->sgr0len);
+    p = putaddress(ctx, p + ctx->sgr0len, pos);
+    color = -1;
+    for (i = 0 ; i < linesize ; ++i) {
+        if (i % groupsize == 0)
+            *p++ = ' ';
+        ch = buf[i];
+        p = putcolor(ctx, p, ch, &color);
+        memcpy(p, ctx->hexcells[ch], 2);
+        p += 2;
+    }
+    memcpy(p, ctx->sgr0, ctx->sgr0len);
+    p += ctx->sgr0len;
+    memcpy(p, "  ", 2);
+    p += 2;
+    color = -1;
+    for (i = 0 ; i < linesize ; ++i) {
+        ch = buf[i];
+        p = putcolor(ctx, p, ch, &color);
+        memcpy(p, ctx->glyphs[ch], ctx->glyphlens[ch]);
+        p += ctx->glyphlens[ch];
+    }
+    memcpy(p, ctx->sgr0, ctx->sgr0len);
+    p += ctx->sgr0len;
+    *p++ = '\n';
+    return p;
+}
+
+/* Define a pair of rendering functions specialized for lines of L
+ * bytes in groups of G. Lines that are not full, which only occur at
+ * the end of a dump, are handed to the generic functions.
+ */
+#define RENDERKERNELS(L, G)                                                 \
+static char *renderuncolored##L##x##G(xcdcontext const *ctx, char *p,       \
+                                      byte const *buf, int count,           \
+                                      long long pos)                        \
+{                                                                           \
+    if (count != L)                                                         \
+        return renderlineuncolored(ctx, p, buf, count, pos);                \
+    return renderfixeduncolored(ctx, p, buf, pos, L, G);                    \
+}                                                                           \
+static char *rendercolored##L##x##G(xcdcontext const *ctx, char *p,         \
+                                    byte const *buf, int count,             \
+                                    long long pos)                          \
+{                                                                           \
+    if (count != L)                                                         \
+        return renderlinecolored(ctx, p, buf, count, pos);                  \
+    return renderfixedcolored(ctx, p, buf, pos, L, G);                      \
+}
+
+RENDERKERNELS(8, 1)
+RENDERKERNELS(8, 2)
+RENDERKERNELS(8, 8)
+RENDERKERNELS(16, 1)
+RENDERKERNELS(16, 2)
+RENDERKERNELS(16, 4)
+RENDERKERNELS(16, 8)
+RENDERKERNELS(16, 16)
+RENDERKERNELS(32, 1)
+RENDERKERNELS(32, 2)
+RENDERKERNELS(32, 4)
+RENDERKERNELS(32, 8)
+
+#define KERNEL(L, G) { L, G, renderuncolored##L##x##G, rendercolored##L##x##G }
+
+/* The line and group sizes that have specialized rendering functions.
+ */
+static struct {
+    int linesize, groupsize;
+    char *(*uncolored)(xcdcontext const*, char*, byte const*, int, long long);
+    char *(*colored)(xcdcontext const*, char*, byte const*, int, long long);
+} const kernels[] = {
+    KERNEL(8, 1), KERNEL(8, 2), KERNEL(8, 8),
+    KERNEL(16, 1), KERNEL(16, 2), KERNEL(16, 4), KERNEL(16, 8),
+    KERNEL(16, 16),
+    KERNEL(32, 1), KERNEL(32, 2), KERNEL(32, 4), KERNEL(32, 8)
+};
+
+/* Select the function that renders lines for the context's format,
+ * preferring a specialized one when one exists for its sizes.
+ */
+static void initrender(xcdcontext *ctx)
+{
+    int i;
+
+    if (ctx->flags & XCD_NOCOLOR)
+        ctx->render = renderlineuncolored;
+    else
+        ctx->render = renderlinecolored;
+    for (i = 0 ; i < (int)(sizeof kernels / sizeof *kernels) ; ++i) {
+        if (kernels[i].linesize == ctx->linesize
+                        && kernels[i].groupsize == ctx->groupsize) {
+            if (ctx->flags & XCD_NOCOLOR)
+                ctx->render = kernels[i].uncolored;
+            else
+                ctx->render = kernels[i].colored;
+            break;
+        }
+    }
+}
+
+/* Output one line of data as a colored hexdump, with only the bytes
+ * that differ from other being colored. A byte that matches returns
+ * the output to the default attributes, which is also how each column
+ * starts, as indicated by a current color of -1.
+ */
+static char *renderlinediff(xcdcontext const *ctx, char *p,
+                            byte const *buf, int count,
+                            byte const *other, int othercount, long long pos)
+{
+    int color, ch, i, j, x;
+
+    memcpy(p, ctx->sgr0, ctx->sgr0len);
+    p = putaddress(ctx, p + ctx->sgr0len, pos);
+    for (j = 0 ; j < 2 ; ++j) {
+        color = -1;
+        if (j == 0) {
+            x = ctx->hexwidth - 2 * count;
+        } else {
+            memset(p, ' ', x + 2);
+            p += x + 2;
+        }
+        for (i = 0 ; i < count ; ++i) {
+            ch = buf[i];
+            if (j == 0 && i % ctx->groupsize == 0) {
+                *p++ = ' ';
+                --x;
+            }
+            if (i < othercount && ch == other[i]) {
+                if (color != -1) {
+                    memcpy(p, ctx->sgr0, ctx->sgr0len);
+                    p += ctx->sgr0len;
+                    color = -1;
+                }
+            } else {
+                p = putcolor(ctx, p, ch, &color);
+            }
+            if (j == 0) {
+                memcpy(p, ctx->hexcells[ch], 2);
+                p += 2;
+            } else {
+                memcpy(p, ctx->glyphs[ch], ctx->glyphlens[ch]);
+                p += ctx->glyphlens[ch];
+            }
+        }
+        memcpy(p, ctx->sgr0, ctx->sgr0len);
+        p += ctx->sgr0len;
+    }
+    *p++ = '\n';
+    return p;
+}
+
+/* Render a single line in the context's format.
+ */
+char *xcd_renderline(xcdcontext const *ctx, char *out,
+                     void const *buf, int count, long long pos)
+{
+    if (ctx->flags & XCD_RAW)
+        return renderbytescolored(ctx, out, buf, count);
+    return ctx->render(ctx, out, buf, count, pos);
+}
+
+/* Render a line with its differences from another highlighted.
+ */
+char *xcd_renderdiffline(xcdcontext const *ctx, char *out,
+                         void const *buf, int count,
+                         void const *other, int othercount, long long pos)
+{
+    if (ctx->flags & (XCD_RAW | XCD_NOCOLOR))
+        return xcd_renderline(ctx, out, buf, count, pos);
+    return renderlinediff(ctx, out, buf, count, other, othercount, pos);
+}
+
+/*
+ * Rendering whole buffers.
+ */
+
+/* Scan a machine word at a time, checking a page's worth of words
+ * before branching, so that long runs of zeroes are passed over
+ * quickly.
+ */
+size_t xcd_zerospan(void const *buf, size_t size)
+{
+    byte const *p = buf;
+    uint64_t w[4], acc;
+    size_t n, i, j;
+
+    for (n = 0 ; n + 4096 <= size ; n += 4096) {
+        acc = 0;
+        for (i = 0 ; i < 4096 ; i += 32) {
+            memcpy(w, p + n + i, 32);
+            acc |= w[0] | w[1] | w[2] | w[3];
+        }
+        if (acc)
+            break;
+    }
+    for ( ; n + 32 <= size ; n += 32) {
+        memcpy(w, p + n, 32);
+        if (w[0] | w[1] | w[2] | w[3])
+            break;
+    }
+    for (j = n + 32 < size ? n + 32 : size ; n < j ; ++n)
+        if (p[n])
+            return n;
+    return n;
+}
+
+/* Output count lines of zeroes, starting at pos. If count is three or
+ * more, all but the first are replaced by an asterisk.
+ */
+static char *putzerolines(xcdcontext *ctx, char *p, long long count,
+                          long long pos)
+{
+    long long i;
+
+    if (count > 2) {
+        p = xcd_renderline(ctx, p, zeroline, ctx->linesize, pos);
+        *p++ = '*';
+        *p++ = '\n';
+    } else {
+        for (i = 0 ; i < count ; ++i)
+            p = xcd_renderline(ctx, p, zeroline, ctx->linesize,
+                               pos + i * ctx->linesize);
+    }
+    return p;
+}
+
+/* Allow for each line of input, plus the lines that may be held back
+ * and the asterisk.
+ */
+size_t xcd_outputsize(xcdcontext const *ctx, size_t size)
+{
+    return (size / ctx->linesize + 4) * (size_t)ctx->maxlinesize;
+}
+
+/* Render each line in turn. When autoskipping, lines of zeroes are
+ * counted instead of rendered, in bulk after the first one, until a
+ * nonzero line appears.
+ */
+size_t xcd_render(xcdcontext *ctx, void const *in, size_t size,
+                  long long pos, char *out)
+{
+    byte const *buf = in;
+    char *p = out;
+    size_t i, n, z;
+
+    for (i = 0 ; i < size ; i += n, pos += n) {
+        n = size - i < (size_t)ctx->linesize ? size - i
+                                             : (size_t)ctx->linesize;
+        if ((ctx->flags & XCD_AUTOSKIP) && xcd_zerospan(buf + i, n) == n) {
+            if (!ctx->zerolines)
+                ctx->zeropos = pos;
+            ++ctx->zerolines;
+            ctx->zerosize = n;
+            if (n == (size_t)ctx->linesize) {
+                z = xcd_zerospan(buf + i + n, size - i - n) / ctx->linesize;
+                ctx->zerolines += z;
+                n += z * ctx->linesize;
+            }
+            continue;
+        }
+        if (ctx->zerolines) {
+            p = putzerolines(ctx, p, ctx->zerolines, ctx->zeropos);
+            ctx->zerolines = 0;
+        }
+        xcd_assigncolors(ctx, buf + i, n);
+        p = xcd_renderline(ctx, p, buf + i, n, pos);
+    }
+    return p - out;
+}
+
+/* Any held lines are output, except that the final line is always
+ * displayed, so that the dump shows where the input ended.
+ */
+size_t xcd_finish(xcdcontext *ctx, char *out)
+{
+    char *p = out;
+    long long last;
+
+    if (ctx->zerolines) {
+        last = ctx->zeropos + (ctx->zerolines - 1) * ctx->linesize;
+        p = putzerolines(ctx, p, ctx->zerolines - 1, ctx->zeropos);
+        p = xcd_renderline(ctx, p, zeroline, ctx->zerosize, last);
+        ctx->zerolines = 0;
+    }
+    return p - out;
+}
@@ -0,0 +1,182 @@
+/*
+ * libxcd.h: The rendering core of xcd, as a reentrant library.
+ *
+ * Copyright (C) 2018 Brian Raiter <breadbox@muppetlabs.com>
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use, copy,
+ * modify, merge, publish, distribute, sublicense, and/or sell copies
+ * of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * All of the library's state is kept in an xcdcontext, which the
+ * caller allocates and initializes with xcd_init(). A context owns no
+ * other resources, so it can simply be discarded when no longer
+ * needed. Separate contexts can be used concurrently from separate
+ * threads. A typical use is:
+ *
+ *     xcdcontext ctx;
+ *     char *out;
+ *     size_t n;
+ *
+ *     xcd_init(&ctx, 16, 2, XCD_AUTOSKIP);
+ *     out = malloc(xcd_outputsize(&ctx, size));
+ *     n = xcd_render(&ctx, data, size, 0, out);
+ *     n += xcd_finish(&ctx, out + n);
+ */
+
+#ifndef _libxcd_h_
+#define _libxcd_h_
+
+#include <stddef.h>
+
+/* Flags that select the output format.
+ */
+#define XCD_NOCOLOR   0x01      /* don't add color to the output */
+#define XCD_RAW       0x02      /* colorize the bytes without a hexdump */
+#define XCD_ASCII     0x04      /* use only ASCII in the text column */
+#define XCD_AUTOSKIP  0x08      /* replace runs of zero lines with "*" */
+
+/* The longest terminal control sequence that a context can store.
+ */
+#define XCD_MAXSEQLEN 32
+
+/* The state of a hexdump and the settings controlling its format.
+ * The fields should be treated as read-only outside of the library.
+ */
+typedef struct xcdcontext {
+    int linesize;               /* number of bytes per line */
+    int groupsize;              /* number of bytes per group */
+    int addrwidth;              /* minimum number of digits in positions */
+    int flags;                  /* the XCD_* flags in effect */
+    int hexwidth;               /* width of the hex byte values */
+    int maxlinesize;            /* most bytes a single line can produce */
+    void (*hexencode)(char *out, unsigned char const *in, int count);
+    char *(*render)(struct xcdcontext const *ctx, char *out,
+                    unsigned char const *buf, int count, long long pos);
+    char hexcells[256][2];      /* hexadecimal form of each byte value */
+    char glyphs[256][4];        /* text column form of each byte value */
+    int glyphlens[256];         /* lengths of the entries in glyphs */
+    char colorseqs[256][XCD_MAXSEQLEN];  /* sequences to select colors */
+    int colorseqlens[256];      /* lengths of the entries in colorseqs */
+    char sgr0[XCD_MAXSEQLEN];   /* sequence to reset the attributes */
+    int sgr0len;                /* length of sgr0 */
+    unsigned char palette[256]; /* color of each byte value, or zero */
+    int nextcolorfromset;       /* the next color to assign */
+    int colorsleft;             /* byte values still lacking a color */
+    long long zerolines;        /* number of zero lines being held back */
+    long long zeropos;          /* position of the first held zero line */
+    int zerosize;               /* size of the last held zero line */
+} xcdcontext;
+
+/* Initialize a context to produce lines of linesize bytes, in groups
+ * of groupsize bytes (or a single group if groupsize is zero), using
+ * the format selected by flags. Color output uses the control
+ * sequences of xterm-256color until xcd_setcolorseqs() is called. The
+ * return value is zero on success, or -1 if the sizes are invalid.
+ */
+extern int xcd_init(xcdcontext *ctx, int linesize, int groupsize, int flags);
+
+/* Return a context to the state of a new dump, forgetting the colors
+ * assigned to byte values and any lines held back, while keeping its
+ * format and control sequences. This allows a context to be reused
+ * for a series of separate dumps.
+ */
+extern void xcd_reset(xcdcontext *ctx);
+
+/* Set the minimum number of hex digits used to display file positions
+ * (eight by default, to a maximum of sixteen). Positions that need
+ * more digits will still be displayed in full.
+ */
+extern void xcd_setaddrwidth(xcdcontext *ctx, int addrwidth);
+
+/* Replace the control sequences used for color output. colorseqs
+ * supplies the sequence that selects each of the 256 colors, and sgr0
+ * the sequence that returns to the default attributes. The return
+ * value is zero on success, or -1 if a sequence is too long.
+ */
+extern int xcd_setcolorseqs(xcdcontext *ctx, char const *const *colorseqs,
+                            char const *sgr0);
+
+/* Return the size of an output buffer that is guaranteed to hold the
+ * rendering of size bytes of input by xcd_render(), plus whatever
+ * xcd_finish() may add.
+ */
+extern size_t xcd_outputsize(xcdcontext const *ctx, size_t size);
+
+/* Render size bytes of input as a hexdump, with pos giving the file
+ * position of the first byte, and store the output in out. The return
+ * value is the number of bytes stored. A dump can be made in pieces by
+ * calling this repeatedly with consecutive input; pieces other than
+ * the last should be a multiple of the line size. When autoskipping,
+ * lines of zeroes may be held back until the next call.
+ */
+extern size_t xcd_render(xcdcontext *ctx, void const *in, size_t size,
+                         long long pos, char *out);
+
+/* Complete a dump, storing any output that was held back in out. The
+ * return value is the number of bytes stored, which will be no more
+ * than three times maxlinesize.
+ */
+extern size_t xcd_finish(xcdcontext *ctx, char *out);
+
+/*
+ * Lower-level functions, for callers that manage their own lines.
+ */
+
+/* Make sure that every byte value in buf that is displayed in color
+ * has been assigned one, in order of appearance.
+ */
+extern void xcd_assigncolors(xcdcontext *ctx, void const *buf, int count);
+
+/* Add the number of occurrences of each byte value in buf to counts.
+ */
+extern void xcd_countbytes(unsigned long long *counts, void const *buf,
+                           size_t size);
+
+/* Assign colors to all remaining byte values according to their
+ * frequency, as given by counts, with the most common byte values
+ * receiving the most distinct colors.
+ */
+extern void xcd_rankcolors(xcdcontext *ctx, unsigned long long const *counts);
+
+/* Render a single line of up to linesize bytes into out, which must
+ * have room for maxlinesize bytes. The bytes' colors must already
+ * have been assigned, as the context is not modified; thus multiple
+ * threads can render lines using the same context. The return value
+ * points past the stored bytes.
+ */
+extern char *xcd_renderline(xcdcontext const *ctx, char *out,
+                            void const *buf, int count, long long pos);
+
+/* Render a line as xcd_renderline() does, except that only the bytes
+ * that differ from the corresponding bytes of other (which holds
+ * othercount bytes) are displayed in color. When the context does
+ * not use color, this is the same as xcd_renderline().
+ */
+extern char *xcd_renderdiffline(xcdcontext const *ctx, char *out,
+                                void const *buf, int count,
+                                void const *other, int othercount,
+                                long long pos);
+
+/* Return the number of zero bytes at the start of buf.
+ */
+extern size_t xcd_zerospan(void const *buf, size_t size);
+
+#endif
@@ -24,18 +24,74 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
+#define _FILE_OFFSET_BITS 64
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
 #include <ctype.h>
 #include <limits.h>
+#include <stdint.h>
+#include <math.h>
 #include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <term.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#include <zlib.h>
+#include "libxcd.h"
 
 typedef unsigned char byte;
 
+/* The largest possible file offset.
+ */
+#define MAXOFFSET ((off_t)INT64_MAX)
+
+/* The size of the buffer used to read input.
+ */
+#define INPUTBUFSIZE (256 * 1024)
+
+/* The alignment of the input buffer and of the file positions read
+ * from, as required for reading with O_DIRECT.
+ */
+#define DIRECTALIGN 4096
+
+/* The amount of the next input file to ask the kernel to read ahead
+ * while the current file is being dumped.
+ */
+#define PREFETCHSIZE (4 * 1024 * 1024)
+
+/* The size of the buffer used to accumulate output.
+ */
+#define OUTPUTBUFSIZE (256 * 1024)
+
+/* The number of lines of input handed to a rendering thread at once.
+ */
+#define JOBLINES 4096
+
+/* The number of blocks summarized on each row of the overview, and
+ * the most blocks that are summarized in one batch.
+ */
+#define OVERVIEWCELLS 64
+#define OVERVIEWBATCH 1024
+
+/* The largest gap between the lines of a dump that --reverse will
+ * fill in by writing it out, when it cannot seek over the gap.
+ */
+#define MAXREVERSEGAP ((off_t)1 << 30)
+
 /* Online help.
  */
 static char const *yowzitch =
@@ -51,9 +107,29 @@ static char const *yowzitch =
     "  -s, --start=N         Start N bytes after start of input\n"
     "  -l, --limit=N         Stop after N bytes of input\n"
     "  -a, --autoskip        Omit lines of zero bytes with a single \"*\"\n"
+    "  -D, --dedup           Omit repeated lines with a single \"*\"\n"
+    "  -f, --follow          Keep dumping data appended to the last file\n"
+    "  -z, --decompress      Dump the contents of gzip and zstd files\n"
     "  -N, --no-color        Suppress color output\n"
     "  -R, --raw             Dump colorized bytes without the hex display\n"
+    "  -r, --reverse         Turn a hex dump back into binary\n"
     "  -A, --ascii           Don't use Unicode characters in text column\n"
+    "      --threads=N       Render using N threads [default=1; 0=per CPU]\n"
+    "      --pipeline        Read, render, and write output concurrently\n"
+    "      --tail=N          Dump only the last N bytes of input\n"
+    "      --range=START:END[,START:END]...\n"
+    "                        Dump only the given ranges of the input\n"
+    "      --pager           Browse the dump interactively\n"
+    "      --diff            Show only the lines that differ between two files\n"
+    "      --find=HEX        Show only the lines containing the given bytes\n"
+    "      --find-text=TEXT  Show only the lines containing the given text\n"
+    "      --context=N       Show N lines around each match [default=0]\n"
+    "      --overview[=N]    Summarize each block of N bytes as a single cell\n"
+    "      --output-dir=DIR  Dump each file separately, to DIR/FILENAME.hex\n"
+    "      --no-cache        Read input without filling the page cache\n"
+    "      --stats           Report throughput and timings to stderr at exit\n"
+    "      --palette=ORDER   Assign colors in ORDER, either \"first\" (order of\n"
+    "                        appearance) or \"frequency\" [default=first]\n"
     "      --help            Display this help and exit\n"
     "      --version         Display version information and exit\n";
 
@@ -65,294 +141,129 @@ static char const *vourzhon =
     "This is free software; you are free to change and redistribute it.\n"
     "There is NO WARRANTY, to the extent permitted by law.\n";
 
-/* The color index palette. This is the list of color indexes for the
- * 256-color xterm, sorted to maximize visual contrast. Colors should
- * be assigned preferentially from the start of this list.
- *
- * To create this index, high-contrast color sets created by design
- * researchers were consulted. References to their papers can be found
- * at <https://graphicdesign.stackexchange.com/a/3815>. The Kenneth
- * Kelly palette was the main source, with some modifications (such as
- * reserving black and other colors often used for normal text). The
- * resulting list of colors was then matched with entries the xterm
- * palette, as close as possible. Finally, the remaining colors in the
- * xterm palette were added, sorted by their color-space distance from
- * each other, but skipping over ones that were too dark to read on a
- * black background. Finally, the last two colors are repeated to fill
- * out the palette to 256 entries.
- */
-static byte const colorset[] = {
-      8,  /* #808080 */
-     11,  /* #FFFF00 */
-     53,  /* #5F005F */
-    202,  /* #FF5F00 */
-     87,  /* #5FFFFF */
-      9,  /* #FF0000 */
-     41,  /* #00D75F */
-    217,  /* #FFAFAF */
-     32,  /* #0087D7 */
-    222,  /* #FFD787 */
-     57,  /* #5F00FF */
-    214,  /* #FFAF00 */
-    126,  /* #AF0087 */
-    191,  /* #D7FF5F */
-     88,  /* #870000 */
-    148,  /* #AFD700 */
-     94,  /* #875F00 */
-    219,  /* #FFAFFF */
-     22,  /* #005F00 */
-    228,  /* #FFFF87 */
-    121,  /* #87FFAF */
-      4,  /* #000080 */
-      3,  /* #808000 */
-     23,  /* #005F5F */
-     30,  /* #008787 */
-    179,  /* #D7AF5F */
-     14,  /* #00FFFF */
-     13,  /* #FF00FF */
-    195,  /* #D7FFFF */
-     12,  /* #0000FF */
-    225,  /* #FFD7FF */
-    123,  /* #87FFFF */
-    230,  /* #FFFFD7 */
-     27,  /* #005FFF */
-    159,  /* #AFFFFF */
-     10,  /* #00FF00 */
-    207,  /* #FF5FFF */
-    165,  /* #D700FF */
-     50,  /* #00FFD7 */
-    227,  /* #FFFF5F */
-    235,  /* #262626 */
-    200,  /* #FF00D7 */
-     45,  /* #00D7FF */
-     82,  /* #5FFF00 */
-    213,  /* #FF87FF */
-    197,  /* #FF005F */
-     47,  /* #00FF5F */
-    255,  /* #EEEEEE */
-     20,  /* #0000D7 */
-    190,  /* #D7FF00 */
-     93,  /* #8700FF */
-    229,  /* #FFFFAF */
-    236,  /* #303030 */
-     33,  /* #0087FF */
-    220,  /* #FFD700 */
-    129,  /* #AF00FF */
-     49,  /* #00FFAF */
-    160,  /* #D70000 */
-     39,  /* #00AFFF */
-    198,  /* #FF0087 */
-    118,  /* #87FF00 */
-    199,  /* #FF00AF */
-     48,  /* #00FF87 */
-    208,  /* #FF8700 */
-     63,  /* #5F5FFF */
-    154,  /* #AFFF00 */
-     81,  /* #5FD7FF */
-     52,  /* #5F0000 */
-    171,  /* #D75FFF */
-    194,  /* #D7FFD7 */
-     17,  /* #00005F */
-    224,  /* #FFD7D7 */
-     40,  /* #00D700 */
-    206,  /* #FF5FD7 */
-     86,  /* #5FFFD7 */
-    237,  /* #3A3A3A */
-    189,  /* #D7D7FF */
-    203,  /* #FF5F5F */
-     83,  /* #5FFF5F */
-     19,  /* #0000AF */
-    254,  /* #E4E4E4 */
-      1,  /* #800000 */
-    221,  /* #FFD75F */
-    177,  /* #D787FF */
-      2,  /* #008000 */
-    117,  /* #87D7FF */
-     18,  /* #000087 */
-    158,  /* #AFFFD7 */
-    212,  /* #FF87D7 */
-    124,  /* #AF0000 */
-    183,  /* #D7AFFF */
-     28,  /* #008700 */
-    122,  /* #87FFD7 */
-    204,  /* #FF5F87 */
-     34,  /* #00AF00 */
-    153,  /* #AFD7FF */
-    193,  /* #D7FFAF */
-     69,  /* #5F87FF */
-    205,  /* #FF5FAF */
-     84,  /* #5FFF87 */
-    238,  /* #444444 */
-    218,  /* #FFAFD7 */
-    192,  /* #D7FF87 */
-     99,  /* #875FFF */
-    119,  /* #87FF5F */
-    135,  /* #AF5FFF */
-    209,  /* #FF875F */
-     75,  /* #5FAFFF */
-    223,  /* #FFD7AF */
-     85,  /* #5FFFAF */
-    215,  /* #FFAF5F */
-     56,  /* #5F00D7 */
-    155,  /* #AFFF5F */
-    164,  /* #D700D7 */
-     58,  /* #5F5F00 */
-     44,  /* #00D7D7 */
-    161,  /* #D7005F */
-    184,  /* #D7D700 */
-     26,  /* #005FD7 */
-     76,  /* #5FD700 */
-    105,  /* #8787FF */
-    166,  /* #D75F00 */
-    120,  /* #87FF87 */
-    141,  /* #AF87FF */
-    210,  /* #FF8787 */
-    239,  /* #4E4E4E */
-    111,  /* #87AFFF */
-    156,  /* #AFFF87 */
-    211,  /* #FF87AF */
-    147,  /* #AFAFFF */
-    216,  /* #FFAF87 */
-    157,  /* #AFFFAF */
-     92,  /* #8700D7 */
-     42,  /* #00D787 */
-    162,  /* #D70087 */
-     38,  /* #00AFD7 */
-    112,  /* #87D700 */
-    163,  /* #D700AF */
-     43,  /* #00D7AF */
-    172,  /* #D78700 */
-    128,  /* #AF00D7 */
-     29,  /* #00875F */
-    253,  /* #DADADA */
-     54,  /* #5F0087 */
-    178,  /* #D7AF00 */
-     24,  /* #005F87 */
-     55,  /* #5F00AF */
-     64,  /* #5F8700 */
-    188,  /* #D7D7D7 */
-     89,  /* #87005F */
-     35,  /* #00AF5F */
-     25,  /* #005FAF */
-    130,  /* #AF5F00 */
-     80,  /* #5FD7D7 */
-    125,  /* #AF005F */
-     70,  /* #5FAF00 */
-    170,  /* #D75FD7 */
-    185,  /* #D7D75F */
-    240,  /* #585858 */
-    252,  /* #D0D0D0 */
-     62,  /* #5F5FD7 */
-     77,  /* #5FD75F */
-      5,  /* #800080 */
-    167,  /* #D75F5F */
-    152,  /* #AFD7D7 */
-      6,  /* #008080 */
-    182,  /* #D7AFD7 */
-     37,  /* #00AFAF */
-    187,  /* #D7D7AF */
-     91,  /* #8700AF */
-    142,  /* #AFAF00 */
-    116,  /* #87D7D7 */
-    136,  /* #AF8700 */
-    176,  /* #D787D7 */
-     31,  /* #0087AF */
-    186,  /* #D7D787 */
-     90,  /* #870087 */
-    106,  /* #87AF00 */
-    127,  /* #AF00AF */
-     36,  /* #00AF87 */
-    100,  /* #878700 */
-    251,  /* #C6C6C6 */
-     59,  /* #5F5F5F */
-     74,  /* #5FAFD7 */
-    134,  /* #AF5FD7 */
-     79,  /* #5FD7AF */
-    149,  /* #AFD75F */
-    169,  /* #D75FAF */
-    241,  /* #626262 */
-     68,  /* #5F87D7 */
-    113,  /* #87D75F */
-    168,  /* #D75F87 */
-     78,  /* #5FD787 */
-     98,  /* #875FD7 */
-    173,  /* #D7875F */
-      7,  /* #C0C0C0 */
-    242,  /* #6C6C6C */
-    146,  /* #AFAFD7 */
-     61,  /* #5F5FAF */
-    151,  /* #AFD7AF */
-     71,  /* #5FAF5F */
-    131,  /* #AF5F5F */
-    181,  /* #D7AFAF */
-     60,  /* #5F5F87 */
-    110,  /* #87AFD7 */
-    150,  /* #AFD787 */
-    175,  /* #D787AF */
-     65,  /* #5F875F */
-    115,  /* #87D7AF */
-    140,  /* #AF87D7 */
-    180,  /* #D7AF87 */
-     95,  /* #875F5F */
-    104,  /* #8787D7 */
-    114,  /* #87D787 */
-    174,  /* #D78787 */
-    250,  /* #BCBCBC */
-    243,  /* #767676 */
-     73,  /* #5FAFAF */
-    133,  /* #AF5FAF */
-    143,  /* #AFAF5F */
-     67,  /* #5F87AF */
-    107,  /* #87AF5F */
-    132,  /* #AF5F87 */
-     72,  /* #5FAF87 */
-     97,  /* #875FAF */
-    137,  /* #AF875F */
-     66,  /* #5F8787 */
-     96,  /* #875F87 */
-    101,  /* #87875F */
-    249,  /* #B2B2B2 */
-    145,  /* #AFAFAF */
-    248,  /* #A8A8A8 */
-    109,  /* #87AFAF */
-    139,  /* #AF87AF */
-    144,  /* #AFAF87 */
-    247,  /* #9E9E9E */
-    103,  /* #8787AF */
-    108,  /* #87AF87 */
-    138,  /* #AF8787 */
-    246,  /* #949494 */
-    245,  /* #8A8A8A */
-    102,  /* #878787 */
-    245,  /* #8A8A8A */
-    102,  /* #878787 */
-    245,  /* #8A8A8A */
-    102,  /* #878787 */
-    245,  /* #8A8A8A */
-    102,  /* #878787 */
-    245,  /* #8A8A8A */
-    102,  /* #878787 */
-    245,  /* #8A8A8A */
-    102,  /* #878787 */
-    245,  /* #8A8A8A */
-    102,  /* #878787 */
-    245,  /* #8A8A8A */
-    102,  /* #878787 */
-};
+/* The state of decompressing a gzip file as it is read.
+ */
+typedef struct decoder {
+    z_stream z;                 /* zlib's state */
+    int ended;                  /* true at the end of a gzip member */
+    byte buf[INPUTBUFSIZE];     /* compressed data read from the file */
+} decoder;
 
 /* The program's input file state and user-controlled settings.
  */
 typedef struct state {
-    int startoffset;    /* skip over this many chars of input at start */
-    int maxinputlen;    /* stop after this many chars of input */
+    off_t startoffset;  /* skip over this many chars of input at start */
+    off_t maxinputlen;  /* stop after this many chars of input */
     char **filenames;   /* NULL-terminated list of input filenames */
-    FILE *currentfile;  /* handle to the currently open input file */
+    int currentfile;    /* descriptor of the open input file, or -1 */
+    int nextfile;       /* descriptor of the following file, or -1 */
+    byte *buf;          /* buffer for data read from the input file */
+    byte *map;          /* memory mapping of the input file, if any */
+    byte const *data;   /* the current block of data, from buf or map */
+    size_t bufpos;      /* position of the next unconsumed byte in data */
+    size_t bufcounted;  /* position in data up to which input is counted */
+    size_t buflen;      /* number of bytes of valid data in data */
+    off_t holecheck;    /* file position where holes should be sought */
+    int silent;         /* true if errors should not be reported */
+    int follow;         /* true if the last file is followed as it grows */
+    int watchfd;        /* inotify descriptor for following, or -1 */
+    int direct;         /* true if the input file is read with O_DIRECT */
+    decoder *decoder;   /* decompresses the input file, if it is gzipped */
+    pid_t child;        /* process decompressing the input file, or 0 */
+    int pending;        /* bytes already read into buf from the file */
+    off_t linepos;      /* file position of the line being retrieved */
+    int linelen;        /* bytes of that line assembled so far in line */
+    int shown;          /* bytes of it displayed while awaiting the rest */
+    byte line[256];     /* space for assembling lines that span files */
 } state;
 
+/* A buffer for accumulating output. When fd is a valid descriptor,
+ * the buffer has a fixed size and its contents are written to fd
+ * whenever it fills up. Otherwise, the buffer grows as needed.
+ */
+typedef struct output {
+    char *buf;          /* the accumulated output */
+    int len;            /* number of bytes of output in buf */
+    int size;           /* the allocated size of buf */
+    int fd;             /* where to write the output, or -1 */
+} output;
+
+/* A piece of the dump, waiting to be rendered by a worker thread. The
+ * input contains the bytes for each line, and rows describes their
+ * sizes and positions. A row with a size of zero stands for the
+ * asterisk that marks omitted lines.
+ */
+typedef struct job {
+    byte *input;        /* the data for the lines, end to end */
+    int inputlen;       /* number of bytes stored in input */
+    struct {
+        off_t pos;      /* the file position of the line */
+        int size;       /* the number of bytes in the line */
+    } *rows;
+    int rowcount;       /* number of entries stored in rows */
+    output out;         /* where the rendered lines are stored */
+    int done;           /* true once rendering has completed */
+} job;
+
+/* The overview's summary of a block of input.
+ */
+typedef struct cell {
+    byte value;         /* the most common byte value in the block */
+    char glyph;         /* the character displayed for the block */
+} cell;
+
+/* A run of whole blocks of input to be summarized for the overview.
+ */
+typedef struct blockrun {
+    byte const *data;   /* the input, starting with the first block */
+    size_t count;       /* number of blocks in the run */
+    cell *cells;        /* where the blocks' summaries are stored */
+} blockrun;
+
+/* The progress of turning a hexdump back into binary.
+ */
+typedef struct reversal {
+    off_t pos;          /* position of the next byte of output */
+    byte line[256];     /* the bytes of the line being decoded */
+    byte last[256];     /* the bytes of the last line decoded */
+    int lastcount;      /* number of bytes in last */
+    int repeat;         /* true if an asterisk followed the last line */
+    int seekable;       /* true if gaps of zeroes can be seeked over */
+} reversal;
+
+/* A portion of the input selected for dumping.
+ */
+typedef struct range {
+    off_t start;        /* file position of the first byte */
+    off_t end;          /* file position following the last byte */
+} range;
+
+/* The progress of a search through the input. Each block of input is
+ * searched as a whole, and the input immediately preceding it is kept
+ * in hist, so that the lines before a match can still be displayed,
+ * and so that matches that span two blocks can be found.
+ */
+typedef struct search {
+    off_t base;         /* file position at which the lines begin */
+    off_t next;         /* first line not yet displayed or passed over */
+    off_t want;         /* lines before this position are to be shown */
+    off_t pos;          /* file position of the start of chunk */
+    byte const *chunk;  /* the block of input currently being searched */
+    size_t chunklen;    /* number of bytes in chunk */
+    byte *hist;         /* copy of the input immediately preceding chunk */
+    size_t histlen;     /* number of bytes stored in hist */
+    size_t histsize;    /* number of bytes allocated for hist */
+    int shown;          /* true once any lines have been displayed */
+} search;
+
 /* True if the program should skip repeated lines of zero bytes.
  */
 static int autoskip = 0;
 
+/* True if the program should skip runs of identical lines.
+ */
+static int dedup = 0;
+
 /* Number of bytes to display per line of dump output. (The default
  * value is 16, which produces output that fits comfortably on an
  * 80-column display.)
@@ -380,26 +291,154 @@ static int colorize = 1;
  */
 static int useunicode = 1;
 
-/* The width of the output containing the hex byte values.
+/* The minimum number of digits used to display the file position.
+ */
+static int addrwidth = 8;
+
+/* Output to stdout is accumulated here until it is written out.
+ */
+static char stdoutbuf[OUTPUTBUFSIZE];
+static output stdoutput = { stdoutbuf, 0, OUTPUTBUFSIZE, STDOUT_FILENO };
+
+/* The number of threads to use for rendering.
+ */
+static int threadcount = 1;
+
+/* True if the program should run as a pipeline, with the reading,
+ * rendering, and writing of output being done on separate threads.
+ * The main thread reads the input and hands it off in jobs to the
+ * rendering threads, and a writing thread outputs the finished jobs
+ * in order. This is implied when using multiple rendering threads.
+ */
+static int pipeline = 0;
+
+/* The state of the worker threads. The jobs array is used as a ring
+ * buffer, which bounds how far ahead of the output the reading and
+ * rendering can get. submitted, taken, and written count the jobs
+ * that have been handed off, picked up by a rendering thread, and
+ * output. (The writing thread is the last entry in threads.)
+ */
+static struct {
+    pthread_t *threads;         /* the rendering threads */
+    job *jobs;                  /* the ring of jobs */
+    int jobcount;               /* the number of entries in jobs */
+    long submitted;             /* the number of jobs handed off */
+    long taken;                 /* the number of jobs started */
+    long written;               /* the number of jobs output */
+    int finished;               /* true when no more jobs will come */
+    pthread_mutex_t lock;       /* protects the preceding fields */
+    pthread_cond_t ready;       /* signals a newly submitted job */
+    pthread_cond_t rendered;    /* signals a newly rendered job */
+    pthread_cond_t freed;       /* signals a newly written job */
+} pool = {
+    NULL, NULL, 0, 0, 0, 0, 0,
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER
+};
+
+/* The rendering context, which holds the output settings and the
+ * palette of colors assigned to byte values.
+ */
+static xcdcontext context;
+
+/* True once the terminal has been prepared for the output.
+ */
+static int terminalready = 0;
+
+/* The strings that initialize the terminal for color output, or NULL
+ * if the terminal has not yet been looked up.
+ */
+static char const *terminit = NULL;
+
+/* The initialization string of xterm-256color, the one terminal that
+ * is handled without consulting the terminfo database.
+ */
+static char const xtermis2[] = "\33[!p\33[?3;4l\33[4l\33>";
+
+/* True if colors should be assigned to byte values in order of their
+ * frequency in the input, instead of in order of appearance.
+ */
+static int frequencypalette = 0;
+
+/* True if the program should avoid leaving the input in the page
+ * cache, so as not to displace the data of other processes.
+ */
+static int nocache = 0;
+
+/* True if the program should decompress input files that are
+ * compressed with gzip or zstd.
+ */
+static int decompress = 0;
+
+/* True if the program should display the differences between two
+ * inputs instead of dumping them.
+ */
+static int diffmode = 0;
+
+/* True if the program should let the user browse the dump
+ * interactively, instead of outputting all of it.
+ */
+static int pagermode = 0;
+
+/* The byte sequence to search for, or NULL if the program is not
+ * searching, and the number of lines of context to display before and
+ * after each line containing a match.
+ */
+static byte const *findpattern = NULL;
+static size_t findlen = 0;
+static int contextlines = 0;
+
+/* The portions of the input to dump, in order, or NULL if only the
+ * portion given by the start and limit is to be dumped.
+ */
+static range *ranges = NULL;
+static int rangecount = 0;
+
+/* True if the program should turn a hexdump back into binary.
+ */
+static int reversemode = 0;
+
+/* True if the program should display an overview of the input, with
+ * each cell summarizing a block of overviewblock bytes. If the block
+ * size is zero, a suitable size is chosen.
+ */
+static int overview = 0;
+static off_t overviewblock = 0;
+
+/* The directory to hold a separate dump of each input file, or NULL
+ * if the input files are to be dumped together as one.
+ */
+static char const *outputdir = NULL;
+
+/* The number of bytes at the end of the input to dump, or zero to dump
+ * all of the input.
  */
-static int hexwidth;
+static off_t tailsize = 0;
 
-/* Terminal control sequence strings. setaf is used to change the
- * color of the following characters, and sgr0 is used to reset
- * characters attributes to the default state.
+/* Set when a signal requests that the tail be dumped immediately.
  */
-static char const *setaf;
-static char const *sgr0;
+static volatile sig_atomic_t tailrequested = 0;
 
-/* The palette of colors to use for each byte value. Initially each
- * entry is set to zero, meaning unassigned.
+/* True if statistics on the program's activity should be reported to
+ * standard error at exit.
  */
-static byte palette[256];
+static int showstats = 0;
 
-/* The index of the first color in colorset that has yet to be
- * assigned to a byte value.
+/* Counters of the program's activity. The times are in seconds. When
+ * running as a pipeline, rendertime is the sum of the time spent by
+ * each rendering thread, and is updated under the pool's lock.
  */
-static int nextcolorfromset = 0;
+static struct statistics {
+    off_t inputbytes;           /* bytes of input examined */
+    off_t outputbytes;          /* bytes of output written */
+    off_t linecount;            /* lines of output, including "*" */
+    off_t elidedcount;          /* input lines elided as repeats */
+    long readcalls;             /* calls to read() */
+    long writecalls;            /* calls to write() */
+    double inputtime;           /* time spent getting input */
+    double rendertime;          /* time spent rendering lines */
+    double outputtime;          /* time spent writing output */
+} stats;
 
 /*
  * Basic functions.
@@ -418,11 +457,114 @@ void die(char const *fmt, ...)
     exit(EXIT_FAILURE);
 }
 
+/* Return the current time in seconds, for measuring elapsed time.
+ */
+static double timenow(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Write a block of data to the given file descriptor, exiting if the
+ * output cannot be written.
+ */
+static void writeall(int fd, char const *buf, int size)
+{
+    double t;
+    ssize_t n;
+    int done;
+
+    t = timenow();
+    stats.outputbytes += size;
+    for (done = 0 ; done < size ; done += n) {
+        n = write(fd, buf + done, size - done);
+        ++stats.writecalls;
+        if (n < 0) {
+            if (errno == EINTR) {
+                n = 0;
+                continue;
+            }
+            perror("stdout");
+            exit(EXIT_FAILURE);
+        }
+    }
+    stats.outputtime += timenow() - t;
+}
+
+/* Write out the contents of an output buffer.
+ */
+static void writeout(output *out)
+{
+    writeall(out->fd, out->buf, out->len);
+    out->len = 0;
+}
+
+/* Return a pointer to space for at least size more bytes in the
+ * output buffer, flushing or enlarging the buffer first if necessary.
+ * The caller then updates len to cover the bytes actually added.
+ */
+static char *outputspace(output *out, int size)
+{
+    if (out->len + size > out->size) {
+        if (out->fd >= 0) {
+            writeout(out);
+        } else {
+            out->size = out->len + size > 2 * out->size ? out->len + size
+                                                        : 2 * out->size;
+            out->buf = realloc(out->buf, out->size);
+            if (!out->buf)
+                die("out of memory");
+        }
+    }
+    return out->buf + out->len;
+}
+
+/* Append a string to the output.
+ */
+static void outputstring(output *out, char const *str)
+{
+    int size;
+
+    size = strlen(str);
+    if (size > out->size && out->fd >= 0) {
+        writeout(out);
+        writeall(out->fd, str, size);
+        return;
+    }
+    memcpy(outputspace(out, size), str, size);
+    out->len += size;
+}
+
+static void flushjobs(void);
+
+/* Write out all pending output, including output that is still being
+ * rendered by other threads.
+ */
+static void flushoutput(void)
+{
+    if (pool.threads)
+        flushjobs();
+    writeout(&stdoutput);
+}
+
 /* Display an error message for the current file and set the exit code.
+ * Pending output is written out first, so that the message appears in
+ * the correct place.
  */
 static void fail(state *s)
 {
-    perror(s->filenames && *s->filenames ? *s->filenames : "xcd");
+    int err = errno;
+
+    if (s->silent)
+        return;
+    flushoutput();
+    errno = err;
+    if (!s->filenames || !*s->filenames)
+        perror("xcd");
+    else
+        perror(strcmp(*s->filenames, "-") ? *s->filenames : "stdin");
     exitcode = EXIT_FAILURE;
 }
 
@@ -446,372 +588,2932 @@ static int getn(char const *str, char const *name, int maxval)
     return n;
 }
 
-/*
- * File I/O.
+/* Read a file offset or size from a string. The number may be
+ * followed by one of the suffixes K, M, G, or T, to multiply the value
+ * by the respective power of 1024. Exit with a simple error message if
+ * the string is not a valid number.
  */
+static off_t getoffset(char const *str, char const *name)
+{
+    unsigned long long n;
+    char *p;
+    int shift;
 
-/* Prepare the current input file, if necessary. (Does nothing if the
- * current input file is already open and is not at the end.) Any
- * errors that occur when opening a file are reported to stderr before
- * moving on to the next input file. The return value is zero if no
- * more input files are available.
+    if (!str || !*str)
+        die("missing argument for %s", name);
+    errno = 0;
+    n = strtoull(str, &p, 0);
+    if (p == str || *str == '-' || errno == ERANGE)
+        die("invalid argument '%s' for %s", str, name);
+    switch (toupper(*p)) {
+      case 'K':     shift = 10;     ++p;    break;
+      case 'M':     shift = 20;     ++p;    break;
+      case 'G':     shift = 30;     ++p;    break;
+      case 'T':     shift = 40;     ++p;    break;
+      default:      shift = 0;              break;
+    }
+    if (*p != '\0' || n > (unsigned long long)MAXOFFSET >> shift)
+        die("invalid argument '%s' for %s", str, name);
+    return (off_t)(n << shift);
+}
+
+/* Read a string of hexadecimal byte values, optionally separated by
+ * whitespace, as the byte sequence to search for. Exit with a simple
+ * error message if the string is not valid.
  */
-static int inputinit(state *s)
+static void getpattern(char const *str)
 {
-    if (!s->currentfile) {
-        if (!*s->filenames)
-            return 0;
-        if (!strcmp(*s->filenames, "-")) {
-            s->currentfile = stdin;
-            *s->filenames = "stdin";
-        } else {
-            s->currentfile = fopen(*s->filenames, "r");
+    byte *pattern;
+    size_t n;
+    int i, d;
+
+    pattern = malloc(strlen(str) / 2 + 1);
+    if (!pattern)
+        die("out of memory");
+    n = 0;
+    while (*str) {
+        if (isspace((unsigned char)*str)) {
+            ++str;
+            continue;
         }
-        if (!s->currentfile) {
-            fail(s);
-            ++s->filenames;
-            return inputinit(s);
+        pattern[n] = 0;
+        for (i = 0 ; i < 2 ; ++i) {
+            d = (unsigned char)*str;
+            if (!isxdigit(d))
+                die("invalid byte string for find");
+            d = isdigit(d) ? d - '0' : toupper(d) - 'A' + 10;
+            pattern[n] = pattern[n] * 16 + d;
+            ++str;
         }
+        ++n;
     }
-    return 1;
+    if (n == 0)
+        die("missing argument for find");
+    findpattern = pattern;
+    findlen = n;
 }
 
-/* Close the current input file, reporting errors if any to stderr.
+/* Compare two ranges by their starting position, for qsort().
  */
-static void inputupdate(state *s)
+static int comparerange(void const *a, void const *b)
 {
-    if (ferror(s->currentfile)) {
-        fail(s);
-        fclose(s->currentfile);
-    } else {
-        if (s->currentfile != stdin)
-            if (fclose(s->currentfile))
-                fail(s);
-    }
-    s->currentfile = 0;
-    ++s->filenames;
+    range const *ra = a, *rb = b;
+
+    return ra->start < rb->start ? -1 : ra->start > rb->start;
 }
 
-/* Get the next byte from the current file. If there are no more byte
- * in the current file, open the next file in the list of filenames
- * and read from that. If there are no more filenames, return EOF.
+/* Read a comma-separated list of ranges of the form START:END, either
+ * of which may be omitted to mean the start or end of the input, and
+ * add them to the ranges to be dumped. The ranges are kept in order,
+ * with any that overlap or adjoin merged together. Exit with a simple
+ * error message if the list is not valid.
  */
-static int nextbyte(state *s)
+static void getranges(char const *str)
 {
-    int ch;
+    char *list, *item, *sep, *p;
+    range r;
+    int i, n;
 
-    for (;;) {
-        if (!inputinit(s))
-            return EOF;
-        ch = fgetc(s->currentfile);
-        if (ch != EOF)
-            return ch;
-        inputupdate(s);
-    }
-}
-
-/* Return a string representing the given character. Latin-1 and
- * Unicode control pictures are used to represent non-ASCII and
- * control characters.
- */
-static char const *getbyterepresentation(byte ch)
-{
-    static char buf[4];
-
-    if (useunicode) {
-        if (ch < 32) {
-            buf[0] = 0xE2;
-            buf[1] = 0x90;
-            buf[2] = 0x80 | ch;
-            buf[3] = '\0';
-        } else if (ch == 32) {
-            buf[0] = 0xE2;
-            buf[1] = 0x90;
-            buf[2] = 0xA0;
-            buf[3] = '\0';
-        } else if (ch < 127) {
-            buf[0] = ch;
-            buf[1] = '\0';
-        } else if (ch == 127) {
-            buf[0] = 0xE2;
-            buf[1] = 0x90;
-            buf[2] = 0xA1;
-            buf[3] = '\0';
-        } else if (ch < 160) {
-            buf[0] = 0xE2;
-            buf[1] = 0x90;
-            buf[2] = 0xA6;
-            buf[3] = '\0';
-        } else if (ch == 160) {
-            buf[0] = 0xE2;
-            buf[1] = 0x90;
-            buf[2] = 0xA3;
-            buf[3] = '\0';
+    list = strdup(str);
+    if (!list)
+        die("out of memory");
+    for (item = strtok_r(list, ",", &p) ; item ;
+                                          item = strtok_r(NULL, ",", &p)) {
+        sep = strchr(item, ':');
+        if (!sep)
+            die("invalid argument '%s' for range", item);
+        *sep++ = '\0';
+        r.start = *item ? getoffset(item, "range") : 0;
+        r.end = *sep ? getoffset(sep, "range") : MAXOFFSET;
+        if (r.end <= r.start)
+            die("invalid argument '%s:%s' for range", item, sep);
+        ranges = realloc(ranges, (rangecount + 1) * sizeof *ranges);
+        if (!ranges)
+            die("out of memory");
+        ranges[rangecount++] = r;
+    }
+    free(list);
+    if (!rangecount)
+        die("missing argument for range");
+
+    qsort(ranges, rangecount, sizeof *ranges, comparerange);
+    for (i = 1, n = 0 ; i < rangecount ; ++i) {
+        if (ranges[i].start <= ranges[n].end) {
+            if (ranges[i].end > ranges[n].end)
+                ranges[n].end = ranges[i].end;
         } else {
-            buf[0] = 0xC0 | (ch >> 6);
-            buf[1] = 0x80 | (ch & 0x3F);
-            buf[2] = '\0';
+            ranges[++n] = ranges[i];
         }
-    } else {
-        buf[0] = isprint(ch) ? ch : '.';
-        buf[1] = '\0';
     }
-    return buf;
+    rangecount = n + 1;
 }
 
 /*
- * Terminal handling functions.
+ * File I/O.
  */
 
-/* Look up the terminal in the terminfo database and initialize it to
- * do color output.
+/* If the current input file is a regular file, map its contents
+ * directly into memory so that it can be read without copying. (The
+ * file's current position is honored, in case standard input is a
+ * file that has already been partially read.)
+ * Failure is not an error; it just means the file will be read
+ * normally.
  */
-static void initoutput(void)
+static void mapinput(state *s)
 {
-    char *termname, *seq;
-    int err;
+    struct stat st;
+    off_t pos;
+    void *p;
 
-    if (!colorize)
+    if (fstat(s->currentfile, &st) || !S_ISREG(st.st_mode))
         return;
-    termname = getenv("TERM");
-    if (setupterm(termname, 1, &err) != 0) {
-        if (err < 0)
-            fprintf(stderr, "error: cannot find terminfo database.\n");
-        else if (err == 0 || !termname || !*termname)
-            fprintf(stderr, "error: cannot identify terminal type.\n");
-        else
-            fprintf(stderr, "error: terminal \"%s\" lacks color; use xxd.\n",
-                    termname);
-        exit(EXIT_FAILURE);
-    }
-    sgr0 = tigetstr("sgr0");
-    setaf = tigetstr("setaf");
-    if (!sgr0 || !setaf) {
-        fprintf(stderr, "error: terminal \"%s\" lacks color; use --no-color"
-                        " (or xxd(1)).\n",
-                termname);
-        exit(EXIT_FAILURE);
-    }
-    if (tigetnum("colors") < 256) {
-        fprintf(stderr, "error: colorizing requires 256 colors,"
-                        " but only %d are available.\n",
-                tigetnum("colors"));
-        exit(EXIT_FAILURE);
-    }
-    seq = tigetstr("is1");
-    if (seq)
-        fputs(seq, stdout);
-    seq = tigetstr("is2");
-    if (seq)
-        fputs(seq, stdout);
-    seq = tigetstr("is3");
-    if (seq)
-        fputs(seq, stdout);
-
-    palette[0] = colorset[0];
-    nextcolorfromset = 1;
+    if ((unsigned long long)st.st_size > SIZE_MAX)
+        return;
+    pos = lseek(s->currentfile, 0, SEEK_CUR);
+    if (pos < 0 || pos >= st.st_size)
+        return;
+    p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, s->currentfile, 0);
+    if (p == MAP_FAILED)
+        return;
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+    s->map = p;
+    s->data = s->map;
+    s->bufpos = pos;
+    s->bufcounted = pos;
+    s->buflen = st.st_size;
 }
 
-/*
- * Three different dump format functions.
- */
-
-/* Output colorized bytes directly.
+/* Open the input file following the current one ahead of time, and
+ * start the kernel reading in its first few megabytes, so that the
+ * data is already in memory when the current file is finished. This
+ * reduces the stall between files when dumping many small ones.
+ * Only regular files are opened early, since opening anything else
+ * (such as a FIFO or a device) could block or have side effects.
+ * Failure is not an error; the file will simply be opened again, and
+ * the error reported, when its turn comes.
  */
-static void renderbytescolored(byte const *buf, int count)
+static void prefetchinput(state *s)
 {
-    int ch, i;
+    struct stat st;
+    char const *name;
 
-    for (i = 0 ; i < count ; ++i) {
-        ch = buf[i];
-        if (!isgraph(ch)) {
-            putchar(ch);
-            continue;
-        }
-        if (!palette[ch])
-            palette[ch] = colorset[nextcolorfromset++];
-        printf("%s%s", tiparm(setaf, palette[ch]), getbyterepresentation(ch));
-    }
-    printf("%s", sgr0);
+    if (s->nextfile >= 0 || !(name = s->filenames[1]) || !strcmp(name, "-"))
+        return;
+    if (stat(name, &st) || !S_ISREG(st.st_mode))
+        return;
+    s->nextfile = open(name, O_RDONLY | O_CLOEXEC);
+    if (s->nextfile >= 0 && !nocache)
+        posix_fadvise(s->nextfile, 0, PREFETCHSIZE, POSIX_FADV_WILLNEED);
 }
 
-/* Output one line of data as a hexdump, containing up to linesize
- * bytes. pos supplies the current file position.
+/* Switch the current input file to reading with O_DIRECT, if it is a
+ * regular file or a block device, so that its data bypasses the page
+ * cache. Failure is not an error (some filesystems don't support
+ * O_DIRECT); the data read will instead be dropped from the cache
+ * after it is read.
  */
-static void renderlineuncolored(byte const *buf, int count, int pos)
+static void directinput(state *s)
 {
-    int i, x;
+    struct stat st;
+    int flags;
 
-    printf("%08X:", pos);
-    x = hexwidth - 2 * count;
-    for (i = 0 ; i < count ; ++i) {
-        if (i % groupsize == 0) {
-            putchar(' ');
-            --x;
-        }
-        printf("%02X", buf[i]);
-    }
-    printf("%*s  ", x, "");
-    for (i = 0 ; i < count ; ++i)
-        fputs(getbyterepresentation(buf[i]), stdout);
-    putchar('\n');
+    if (s->currentfile == STDIN_FILENO || fstat(s->currentfile, &st)
+                                       || (!S_ISREG(st.st_mode)
+                                           && !S_ISBLK(st.st_mode)))
+        return;
+    flags = fcntl(s->currentfile, F_GETFL);
+    if (flags >= 0 && !fcntl(s->currentfile, F_SETFL, flags | O_DIRECT))
+        s->direct = 1;
 }
 
-/* Output one line of data as a hexdump, containing up to linesize
- * bytes. pos supplies the current file position.
+/* Identify the compression format, if any, from the first size bytes
+ * of some data. The return value is 'g' for gzip, 'z' for zstd, or
+ * zero.
  */
-static void renderlinecolored(byte const *buf, int count, int pos)
+static int magictype(byte const *magic, int size)
 {
-    int ch, i, x;
-
-    printf("%s%08X:", sgr0, pos);
-    x = hexwidth - 2 * count;
-    for (i = 0 ; i < count ; ++i) {
-        if (i % groupsize == 0) {
-            putchar(' ');
-            --x;
-        }
-        ch = buf[i];
-        if (!palette[ch])
-            palette[ch] = colorset[nextcolorfromset++];
-        printf("%s%02X", tiparm(setaf, palette[ch]), ch);
-    }
-    printf("%s%*s  ", sgr0, x, "");
-    for (i = 0 ; i < count ; ++i) {
-        ch = buf[i];
-        if (!palette[ch])
-            palette[ch] = colorset[nextcolorfromset++];
-        printf("%s%s", tiparm(setaf, palette[ch]), getbyterepresentation(ch));
-    }
-    printf("%s\n", sgr0);
+    if (size >= 2 && magic[0] == 0x1F && magic[1] == 0x8B)
+        return 'g';
+    if (size >= 4 && !memcmp(magic, "\x28\xB5\x2F\xFD", 4))
+        return 'z';
+    return 0;
 }
 
-/*
- * The line output functions.
+/* Identify the format of a file, if it is a regular file compressed
+ * with gzip or zstd, by checking for the magic number at its current
+ * position. The return value is as for magictype().
  */
+static int compression(int fd)
+{
+    struct stat st;
+    byte magic[4];
+    off_t pos;
 
-/* Display a single line of a hexdump appropriate in the requested
- * format.
+    if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+        return 0;
+    pos = lseek(fd, 0, SEEK_CUR);
+    if (pos < 0 || pread(fd, magic, sizeof magic, pos) != sizeof magic)
+        return 0;
+    return magictype(magic, sizeof magic);
+}
+
+/* Identify the format of the current input file, if it is a pipe,
+ * from its first few bytes. Since they cannot be read again, they are
+ * left in the input buffer, and noted as pending. The return value is
+ * as for magictype().
  */
-static void dumpline(byte const *buf, int count, int pos)
+static int pipecompression(state *s)
 {
-    if (count) {
-        if (!hexoutput)
-            renderbytescolored(buf, count);
-        else if (colorize)
-            renderlinecolored(buf, count, pos);
-        else
-            renderlineuncolored(buf, count, pos);
+    struct stat st;
+    ssize_t n;
+
+    if (fstat(s->currentfile, &st)
+                || !(S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)))
+        return 0;
+    while (s->pending < 4) {
+        n = read(s->currentfile, s->buf + s->pending, 4 - s->pending);
+        ++stats.readcalls;
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        s->pending += n;
     }
+    return magictype(s->buf, s->pending);
 }
 
-/* Display some hexdump lines consisting entirely of zero bytes. If
- * count is three or more, all but the first are elided.
+/* Run zstd to decompress data fed to it from fd, with its output going
+ * to out. If some bytes have already been read from fd, they have to
+ * be fed to zstd first, which requires an intermediate process to
+ * pass the data along; otherwise zstd reads from fd itself. (That
+ * process keeps no other descriptors open, since it does not exec,
+ * and exits the same way zstd does.) This is called in a child
+ * process, and does not return.
  */
-static void dumpzerolines(int count, int pos)
+static void runzstd(int fd, byte const *prefix, int prefixsize, int out)
 {
-    static byte zeroline[256];
-    int i;
+    char buf[65536];
+    int fds[2], status;
+    ssize_t n;
+    pid_t pid;
 
-    if (count > 2) {
-        dumpline(zeroline, linesize, pos);
-        printf("*\n");
-    } else {
-        for (i = 0 ; i < count ; ++i)
-            dumpline(zeroline, linesize, pos + i * linesize);
+    if (prefixsize) {
+        if (pipe2(fds, O_CLOEXEC))
+            _exit(127);
+        pid = fork();
+        if (pid < 0)
+            _exit(127);
+        if (pid > 0) {
+            dup2(fd, STDIN_FILENO);
+            dup2(fds[1], STDOUT_FILENO);
+            close_range(3, ~0U, 0);
+            if (write(STDOUT_FILENO, prefix, prefixsize) == prefixsize)
+                while ((n = read(STDIN_FILENO, buf, sizeof buf)) > 0
+                                || (n < 0 && errno == EINTR))
+                    if (n > 0 && write(STDOUT_FILENO, buf, n) != n)
+                        break;
+            close(STDOUT_FILENO);
+            while (waitpid(pid, &status, 0) < 0 && errno == EINTR) ;
+            if (WIFSIGNALED(status)) {
+                signal(WTERMSIG(status), SIG_DFL);
+                raise(WTERMSIG(status));
+            }
+            _exit(WIFEXITED(status) ? WEXITSTATUS(status) : 127);
+        }
+        close(fds[1]);
+        fd = fds[0];
     }
+    dup2(fd, STDIN_FILENO);
+    dup2(out, STDOUT_FILENO);
+    execlp("zstd", "zstd", "-dcq", (char*)NULL);
+    write(STDERR_FILENO, "xcd: unable to run zstd\n", 24);
+    _exit(127);
 }
 
-/* Display hexdump lines from the given filenames until there's no
- * more input.
+/* Arrange for the current input file to be decompressed as it is
+ * read, if it is compressed. A gzip file is decompressed in-process,
+ * directly into the input buffer. A zstd file is handed to a zstd
+ * process, whose output then takes the place of the file, so that it
+ * is decompressed in parallel with the dump. A pipe is identified by
+ * its first bytes, which are then passed on to the decompressor (or,
+ * if it is not compressed, left pending in the input buffer). The
+ * return value is false if the file is not being decompressed.
  */
-static void dumpfiles(state *s, int pos)
+static int startdecoder(state *s)
 {
-    byte    line[256];
-    int     ch = 0, n;
+    int fds[2];
+    pid_t pid;
+    int type;
 
-    while (ch != EOF && s->maxinputlen > 0) {
-        for (n = 0 ; n < linesize && s->maxinputlen > 0 ; ++n) {
-            ch = nextbyte(s);
-            if (ch == EOF)
-                break;
-            line[n] = ch;
-            --s->maxinputlen;
+    type = compression(s->currentfile);
+    if (!type)
+        type = pipecompression(s);
+    switch (type) {
+      case 'g':
+        s->decoder = calloc(1, sizeof *s->decoder);
+        if (!s->decoder || inflateInit2(&s->decoder->z, 15 + 16) != Z_OK)
+            die("out of memory");
+        memcpy(s->decoder->buf, s->buf, s->pending);
+        s->decoder->z.next_in = s->decoder->buf;
+        s->decoder->z.avail_in = s->pending;
+        s->pending = 0;
+        return 1;
+      case 'z':
+        if (pipe2(fds, O_CLOEXEC))
+            return 0;
+        pid = fork();
+        if (pid == 0) {
+            close(fds[0]);
+            runzstd(s->currentfile, s->buf, s->pending, fds[1]);
         }
-        if (n == 0)
-            break;
-        dumpline(line, n, pos);
-        pos += n;
+        close(fds[1]);
+        if (pid < 0) {
+            close(fds[0]);
+            return 0;
+        }
+        if (s->currentfile != STDIN_FILENO)
+            close(s->currentfile);
+        s->currentfile = fds[0];
+        s->child = pid;
+        s->pending = 0;
+        return 1;
     }
+    return 0;
 }
 
-/* Display hexdump lines from the given filenames until there's no
- * more input. Lines are checked for the presence of nonzero bytes,
- * and lines that are all zeroes are deferred until a nonzero byte is
- * found. At that point, if three or more lines of zeroes were found,
- * all but the first are omitted. If the end of input is reached while
- * searching for a nonzero byte, then all but the first and last line
- * are omitted.
+/* Release the current input file's decompressor, if it has one. A
+ * zstd process that fails is counted as an error (it will already
+ * have reported the problem), but not one that is cut off because
+ * the rest of its output is not wanted.
  */
-static void dumpfileswithautoskip(state *s, int pos)
+static void enddecoder(state *s)
 {
-    byte    line[256];
-    int     linesheld = 0, lastheldsize = 0, holdpos = 0;
-    int     nonzero, ch = 0, n;
+    int status = 0;
 
-    while (ch != EOF && s->maxinputlen > 0) {
-        nonzero = 0;
-        for (n = 0 ; n < linesize && s->maxinputlen > 0 ; ++n) {
-            ch = nextbyte(s);
-            if (ch == EOF)
-                break;
-            line[n] = ch;
-            nonzero |= ch;
-            --s->maxinputlen;
-        }
-        if (n == 0)
-            break;
-        if (nonzero) {
+    if (s->decoder) {
+        inflateEnd(&s->decoder->z);
+        free(s->decoder);
+        s->decoder = NULL;
+    }
+    if (s->child) {
+        while (waitpid(s->child, &status, 0) < 0 && errno == EINTR) ;
+        s->child = 0;
+        if (WIFEXITED(status) && WEXITSTATUS(status) && !s->silent)
+            exitcode = EXIT_FAILURE;
+    }
+}
+
+/* Prepare the current input file, if necessary. (Does nothing if the
+ * current input file is already open and is not at the end.) Any
+ * errors that occur when opening a file are reported to stderr before
+ * moving on to the next input file. The return value is zero if no
+ * more input files are available.
+ */
+static int inputinit(state *s)
+{
+    if (!s->buf) {
+        if (posix_memalign((void**)&s->buf, DIRECTALIGN, INPUTBUFSIZE))
+            die("out of memory");
+    }
+    while (s->currentfile < 0) {
+        if (!*s->filenames)
+            return 0;
+        if (!strcmp(*s->filenames, "-")) {
+            s->currentfile = STDIN_FILENO;
+        } else if (s->nextfile >= 0) {
+            s->currentfile = s->nextfile;
+            s->nextfile = -1;
+        } else {
+            s->currentfile = open(*s->filenames, O_RDONLY | O_CLOEXEC);
+        }
+        if (s->currentfile < 0) {
+            fail(s);
+            ++s->filenames;
+        } else {
+            s->holecheck = 0;
+            if (!decompress || !startdecoder(s)) {
+                if (nocache)
+                    directinput(s);
+                else
+                    mapinput(s);
+            }
+            if (!s->map)
+                posix_fadvise(s->currentfile, 0, 0, POSIX_FADV_SEQUENTIAL);
+            prefetchinput(s);
+        }
+    }
+    return 1;
+}
+
+/* Close the current input file, reporting errors if any to stderr.
+ * If failed is true, an error has already occurred while reading.
+ */
+static void inputupdate(state *s, int failed)
+{
+    if (failed) {
+        fail(s);
+        if (s->currentfile != STDIN_FILENO)
+            close(s->currentfile);
+    } else {
+        if (s->currentfile != STDIN_FILENO)
+            if (close(s->currentfile))
+                fail(s);
+    }
+    enddecoder(s);
+    s->currentfile = -1;
+    s->direct = 0;
+    ++s->filenames;
+}
+
+/* Return true if the current input file is at its end and should be
+ * followed, i.e. waited on for more data to be appended. This is only
+ * done for the last input file, and only when it is a regular file.
+ */
+static int following(state const *s)
+{
+    struct stat st;
+
+    return s->follow && !s->filenames[1] && !fstat(s->currentfile, &st)
+                     && S_ISREG(st.st_mode);
+}
+
+static void dumpline(byte const *buf, int count, off_t pos);
+
+/* Erase the incomplete line displayed by showpartialline(), if any.
+ * This is only possible when the output is a terminal; otherwise, the
+ * line is left in place, and will simply be displayed again.
+ */
+static void erasepartialline(state *s)
+{
+    if (s->shown && isatty(STDOUT_FILENO)) {
+        outputstring(&stdoutput, "\33[A\33[K");
+        if (pool.threads)
+            writeout(&stdoutput);
+    }
+    s->shown = 0;
+}
+
+/* Display the incomplete line that has been assembled so far, when
+ * the input being followed has stopped partway through it, so that
+ * the last bytes written are not hidden. (Once the rest of the line
+ * arrives, it is erased and displayed again in full.)
+ */
+static void showpartialline(state *s)
+{
+    erasepartialline(s);
+    dumpline(s->line, s->linelen, s->linepos);
+    s->shown = s->linelen;
+}
+
+/* Wait for the current input file to grow. inotify is used to sleep
+ * until the file is modified, but the wait is also limited to one
+ * second, which covers any changes made before the watch was created
+ * (and which is all that is done if inotify is unavailable). The
+ * first call only creates the watch, so that the file can be checked
+ * once more before waiting. Any output is written out first,
+ * including the part of a line that has arrived so far.
+ */
+static void waitforinput(state *s)
+{
+    char events[4096];
+    struct pollfd pfd;
+    char const *name;
+
+    if (s->watchfd == -1) {
+        name = strcmp(*s->filenames, "-") ? *s->filenames : "/dev/stdin";
+        s->watchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (s->watchfd >= 0 && inotify_add_watch(s->watchfd, name,
+                                                 IN_MODIFY | IN_ATTRIB) < 0) {
+            close(s->watchfd);
+            s->watchfd = -2;
+        }
+        if (s->watchfd < 0)
+            s->watchfd = -2;
+        return;
+    }
+    if (s->linelen > s->shown)
+        showpartialline(s);
+    flushoutput();
+    pfd.fd = s->watchfd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, 1000) > 0)
+        while (read(s->watchfd, events, sizeof events) > 0) ;
+}
+
+/* Add the input consumed since the last call to the statistics. Bytes
+ * that are skipped over without being examined are not counted, nor
+ * are the extra passes over the input made with errors silenced.
+ */
+static void countinput(state *s)
+{
+    if (!s->silent)
+        stats.inputbytes += s->bufpos - s->bufcounted;
+    s->bufcounted = s->bufpos;
+}
+
+/* Release the current input file's memory mapping and close it. (If
+ * the file is being followed, it is instead left open, positioned
+ * after the mapped data, so that anything appended will be read.)
+ */
+static void unmapinput(state *s)
+{
+    munmap(s->map, s->buflen);
+    s->map = NULL;
+    if (following(s))
+        lseek(s->currentfile, s->buflen, SEEK_SET);
+    else
+        inputupdate(s, 0);
+    s->bufpos = 0;
+    s->bufcounted = 0;
+    s->buflen = 0;
+}
+
+/* Decompress the next block of a gzip file into the input buffer. A
+ * file may hold several gzip members, which are decompressed one
+ * after another. The return value is the same as for read(): the
+ * number of bytes stored, zero at the end of the file, or -1 if the
+ * file cannot be read or is corrupt. (A file that ends in the middle
+ * of a member is also corrupt, unless it is being followed.)
+ */
+static ssize_t inflateinput(state *s)
+{
+    decoder *d = s->decoder;
+    ssize_t n;
+    int r;
+
+    d->z.next_out = s->buf;
+    d->z.avail_out = INPUTBUFSIZE;
+    while (d->z.avail_out == INPUTBUFSIZE) {
+        if (d->z.avail_in == 0) {
+            n = read(s->currentfile, d->buf, sizeof d->buf);
+            ++stats.readcalls;
+            if (n == 0 && !d->ended && !following(s)) {
+                errno = EBADMSG;
+                return -1;
+            }
+            if (n <= 0)
+                return n;
+            d->z.next_in = d->buf;
+            d->z.avail_in = n;
+        }
+        if (d->ended) {
+            inflateReset(&d->z);
+            d->ended = 0;
+        }
+        r = inflate(&d->z, Z_NO_FLUSH);
+        if (r == Z_STREAM_END) {
+            d->ended = 1;
+        } else if (r != Z_OK) {
+            errno = r == Z_MEM_ERROR ? ENOMEM : EBADMSG;
+            return -1;
+        }
+    }
+    return INPUTBUFSIZE - d->z.avail_out;
+}
+
+/* Read the next block of the current input file into the input
+ * buffer. With O_DIRECT, a read has to start at an aligned position,
+ * so it starts at the aligned position preceding the current one, and
+ * the bytes before it in the buffer are passed over. Otherwise, if the
+ * page cache is to be avoided, the data is dropped from the cache
+ * once it has been read. The return value is the same as for read().
+ */
+static ssize_t readinput(state *s)
+{
+    off_t pos = 0;
+    size_t skip = 0;
+    ssize_t n;
+
+    if (nocache)
+        pos = lseek(s->currentfile, 0, SEEK_CUR);
+    if (s->direct && pos > 0 && (skip = pos % DIRECTALIGN))
+        lseek(s->currentfile, pos - skip, SEEK_SET);
+    n = read(s->currentfile, s->buf, INPUTBUFSIZE);
+    ++stats.readcalls;
+    if (skip) {
+        if (n > (ssize_t)skip) {
+            s->bufpos = skip;
+            s->bufcounted = skip;
+        } else {
+            lseek(s->currentfile, pos, SEEK_SET);
+            if (n > 0)
+                n = 0;
+        }
+    }
+    if (n > 0 && nocache && !s->direct && pos >= 0)
+        posix_fadvise(s->currentfile, pos, n, POSIX_FADV_DONTNEED);
+    return n;
+}
+
+/* Refill the input buffer with the next block of data, moving on to
+ * the following input files as each one is exhausted. The return
+ * value is zero if there is no more input. A file being followed
+ * never runs out of input; instead, this waits for more to appear. (If
+ * a read or a wait is interrupted by a request to dump the tail, the
+ * buffer is left empty, so that the request can be handled without
+ * waiting for more input.)
+ */
+static int fillbuffer(state *s)
+{
+    double t;
+    ssize_t n;
+    int r;
+
+    t = timenow();
+    r = 1;
+    countinput(s);
+    if (s->map)
+        unmapinput(s);
+    s->bufpos = 0;
+    s->bufcounted = 0;
+    s->buflen = 0;
+    for (;;) {
+        if (!inputinit(s)) {
+            r = 0;
+            break;
+        }
+        if (s->map)
+            break;
+        s->data = s->buf;
+        if (s->decoder) {
+            n = inflateinput(s);
+        } else if (s->pending) {
+            n = s->pending;
+            s->pending = 0;
+        } else {
+            n = readinput(s);
+        }
+        if (n > 0) {
+            s->buflen = n;
+            break;
+        }
+        if ((n < 0 && errno == EINTR) || (n == 0 && following(s))) {
+            if (n == 0)
+                waitforinput(s);
+            if (tailrequested)
+                break;
+            continue;
+        }
+        inputupdate(s, n < 0);
+    }
+    stats.inputtime += timenow() - t;
+    return r;
+}
+
+/* Get the next (up to) count bytes of input as a single contiguous
+ * array. The return value is the number of bytes actually retrieved,
+ * which will only be less than count at the end of the input, and
+ * *data is set to point at them. When possible the bytes are returned
+ * directly from the input buffer or file mapping; otherwise (i.e.
+ * when crossing into another block or file) they are assembled into
+ * the state's line array. A line that was displayed incomplete while
+ * waiting for input is erased once it has been retrieved.
+ */
+static int nextline(state *s, int count, byte const **data)
+{
+    size_t n;
+    int size;
+
+    if (s->buflen - s->bufpos >= (size_t)count) {
+        *data = s->data + s->bufpos;
+        s->bufpos += count;
+        return count;
+    }
+    size = 0;
+    while (size < count) {
+        s->linelen = size;
+        if (s->bufpos == s->buflen && !fillbuffer(s))
+            break;
+        n = s->buflen - s->bufpos;
+        if (n > (size_t)(count - size))
+            n = count - size;
+        memcpy(s->line + size, s->data + s->bufpos, n);
+        s->bufpos += n;
+        size += n;
+    }
+    s->linelen = 0;
+    if (s->shown)
+        erasepartialline(s);
+    *data = s->line;
+    return size;
+}
+
+/* If the current input position lies within a hole in a sparse file,
+ * skip over as many complete lines as the hole contains, up to a
+ * maximum of maxlines, without reading them. The return value is the
+ * number of lines skipped. Since the filesystem is queried at most
+ * once per extent, files without holes cost only a single query.
+ */
+static off_t skipholes(state *s, off_t maxlines)
+{
+#if defined SEEK_HOLE && defined SEEK_DATA
+    struct stat st;
+    off_t cur, here, hole, data, n;
+
+    if (s->currentfile < 0 || s->decoder)
+        return 0;
+    if (s->map) {
+        cur = 0;
+        here = s->bufpos;
+    } else {
+        cur = lseek(s->currentfile, 0, SEEK_CUR);
+        if (cur < 0)
+            return 0;
+        here = cur - (s->buflen - s->bufpos);
+    }
+    if (here < s->holecheck)
+        return 0;
+
+    n = 0;
+    hole = lseek(s->currentfile, here, SEEK_HOLE);
+    if (hole < 0) {
+        s->holecheck = MAXOFFSET;
+    } else if (hole > here) {
+        s->holecheck = hole;
+    } else {
+        data = lseek(s->currentfile, here, SEEK_DATA);
+        if (data < 0 && errno == ENXIO && !fstat(s->currentfile, &st))
+            data = st.st_size;
+        if (data < 0) {
+            s->holecheck = MAXOFFSET;
+        } else {
+            s->holecheck = data;
+            n = (data - here) / linesize;
+            if (n > maxlines)
+                n = maxlines;
+            if (here + n * linesize == data) {
+                hole = lseek(s->currentfile, data, SEEK_HOLE);
+                s->holecheck = hole < 0 ? MAXOFFSET : hole;
+            }
+        }
+    }
+
+    countinput(s);
+    if (s->map || n * linesize <= (off_t)(s->buflen - s->bufpos)) {
+        s->bufpos += n * linesize;
+        s->bufcounted = s->bufpos;
+        if (!s->map)
+            lseek(s->currentfile, cur, SEEK_SET);
+    } else {
+        s->bufpos = 0;
+        s->bufcounted = 0;
+        s->buflen = 0;
+        lseek(s->currentfile, here + n * linesize, SEEK_SET);
+    }
+    return n;
+#else
+    (void)s;
+    (void)maxlines;
+    return 0;
+#endif
+}
+
+/* Return the number of bytes at the start of a and b that are the
+ * same. Large blocks are compared first, so that long identical
+ * stretches are passed over quickly.
+ */
+static size_t matchspan(byte const *a, byte const *b, size_t size)
+{
+    size_t n;
+
+    for (n = 0 ; n + 4096 <= size && !memcmp(a + n, b + n, 4096) ; n += 4096) ;
+    for ( ; n + 64 <= size && !memcmp(a + n, b + n, 64) ; n += 64) ;
+    for ( ; n < size && a[n] == b[n] ; ++n) ;
+    return n;
+}
+
+/* Skip over as many complete lines of zero bytes as are immediately
+ * available, either in a hole in the current input file or in the
+ * current block of input, up to a maximum of maxlines. The return
+ * value is the number of lines skipped. (The scan of a file mapping
+ * stops at the next place where a hole might begin, so that the
+ * hole can be skipped instead of scanned.)
+ */
+static off_t skipzerolines(state *s, off_t maxlines)
+{
+    off_t holelines, n;
+    size_t size;
+
+    holelines = skipholes(s, maxlines);
+    maxlines -= holelines;
+    size = s->buflen - s->bufpos;
+    if (s->map && s->holecheck > (off_t)s->bufpos
+               && s->holecheck - (off_t)s->bufpos < (off_t)size)
+        size = s->holecheck - s->bufpos;
+    n = xcd_zerospan(s->data + s->bufpos, size) / linesize;
+    if (n > maxlines)
+        n = maxlines;
+    s->bufpos += n * linesize;
+    return holelines + n;
+}
+
+/* Skip over as many complete lines that repeat the given line as are
+ * immediately available in the current block of input, up to a
+ * maximum of maxlines. Once the first repeat has been found, the rest
+ * are found by comparing the block against itself, one line further
+ * on, so the whole run is checked in a single pass. The return value
+ * is the number of lines skipped.
+ */
+static off_t skiprepeatedlines(state *s, byte const *line, off_t maxlines)
+{
+    size_t size, n;
+
+    size = s->buflen - s->bufpos;
+    if ((off_t)size > maxlines * linesize)
+        size = maxlines * linesize;
+    size -= size % linesize;
+    if (size == 0 || memcmp(s->data + s->bufpos, line, linesize))
+        return 0;
+    n = linesize + matchspan(s->data + s->bufpos + linesize,
+                             s->data + s->bufpos, size - linesize);
+    n -= n % linesize;
+    s->bufpos += n;
+    return n / linesize;
+}
+
+/* Attempt to skip forward over *count bytes of the current input file
+ * without reading them. This is only possible when the file is a
+ * regular file or a block device, so that its size is known. If the
+ * file is shorter than *count, it is skipped entirely and closed. The
+ * return value is false if the file could not be skipped over, in
+ * which case it will need to be read instead. Otherwise, *count is
+ * updated with the number of bytes left to skip.
+ */
+static int seekinput(state *s, off_t *count)
+{
+    struct stat st;
+    off_t pos, size;
+
+    if (s->decoder || fstat(s->currentfile, &st))
+        return 0;
+    if (!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode))
+        return 0;
+    pos = lseek(s->currentfile, 0, SEEK_CUR);
+    if (pos < 0)
+        return 0;
+    if (S_ISREG(st.st_mode))
+        size = st.st_size;
+    else
+        size = lseek(s->currentfile, 0, SEEK_END);
+    if (size < 0)
+        return 0;
+    if (size - pos <= *count && following(s))
+        return 0;
+    if (size - pos > *count) {
+        if (lseek(s->currentfile, pos + *count, SEEK_SET) < 0)
+            return 0;
+        *count = 0;
+    } else {
+        *count -= size > pos ? size - pos : 0;
+        inputupdate(s, 0);
+    }
+    return 1;
+}
+
+/* Skip over the next count bytes of input. Whole files are skipped
+ * over using their size, and the file containing the starting point
+ * is entered via seeking, so that the skipped data is only read when
+ * the input is not seekable. The return value is zero if the input
+ * ran out before count bytes were skipped.
+ */
+static int skipinput(state *s, off_t count)
+{
+    size_t n;
+
+    countinput(s);
+    for (;;) {
+        n = s->buflen - s->bufpos;
+        if ((off_t)n >= count) {
+            s->bufpos += count;
+            s->bufcounted = s->bufpos;
+            return 1;
+        }
+        count -= n;
+        s->bufpos = s->buflen;
+        s->bufcounted = s->bufpos;
+        if (s->map)
+            unmapinput(s);
+        if (!inputinit(s))
+            return 0;
+        if (s->map || seekinput(s, &count))
+            continue;
+        if (!fillbuffer(s))
+            return 0;
+    }
+}
+
+/* Close any input files left open by a state that was used to read
+ * the input a second time, and free its buffer.
+ */
+static void closeinput(state *s)
+{
+    countinput(s);
+    if (s->map)
+        unmapinput(s);
+    else if (s->currentfile >= 0 && s->currentfile != STDIN_FILENO)
+        close(s->currentfile);
+    enddecoder(s);
+    if (s->nextfile >= 0)
+        close(s->nextfile);
+    free(s->buf);
+}
+
+/*
+ * Terminal handling functions.
+ */
+
+/* Set up the rendering context. The terminal is set up later, once
+ * there is output that needs it.
+ */
+static void initoutput(void)
+{
+    if (xcd_init(&context, linesize, groupsize,
+                 (colorize ? 0 : XCD_NOCOLOR) | (hexoutput ? 0 : XCD_RAW)
+                                              | (useunicode ? 0 : XCD_ASCII)))
+        die("invalid line or group size");
+    xcd_setaddrwidth(&context, addrwidth);
+    terminalready = !colorize;
+}
+
+/* Look up the terminal's color control sequences and initialization
+ * strings. For xterm-256color, the rendering context's built-in
+ * control sequences are already correct, so only its initialization
+ * string is needed. Otherwise, look up the terminal in the terminfo
+ * database and have the context use its control sequences. The
+ * initialization strings are retained in terminit.
+ */
+static void lookupterminal(void)
+{
+    output init = { NULL, 0, 0, -1 };
+    char const *colorseqs[256];
+    char const *setaf, *sgr0;
+    char *termname, *seq;
+    int err, i;
+
+    termname = getenv("TERM");
+    if (termname && !strcmp(termname, "xterm-256color")) {
+        terminit = xtermis2;
+        return;
+    }
+    if (setupterm(termname, 1, &err) != 0) {
+        if (err < 0)
+            fprintf(stderr, "error: cannot find terminfo database.\n");
+        else if (err == 0 || !termname || !*termname)
+            fprintf(stderr, "error: cannot identify terminal type.\n");
+        else
+            fprintf(stderr, "error: terminal \"%s\" lacks color; use xxd.\n",
+                    termname);
+        exit(EXIT_FAILURE);
+    }
+    sgr0 = tigetstr("sgr0");
+    setaf = tigetstr("setaf");
+    if (!sgr0 || !setaf) {
+        fprintf(stderr, "error: terminal \"%s\" lacks color; use --no-color"
+                        " (or xxd(1)).\n",
+                termname);
+        exit(EXIT_FAILURE);
+    }
+    if (tigetnum("colors") < 256) {
+        fprintf(stderr, "error: colorizing requires 256 colors,"
+                        " but only %d are available.\n",
+                tigetnum("colors"));
+        exit(EXIT_FAILURE);
+    }
+    for (i = 0 ; i < 256 ; ++i) {
+        colorseqs[i] = strdup(tiparm(setaf, i));
+        if (!colorseqs[i])
+            die("out of memory");
+    }
+    if (xcd_setcolorseqs(&context, colorseqs, sgr0)
+                || context.maxlinesize > OUTPUTBUFSIZE)
+        die("terminal control sequences are too long");
+    for (i = 0 ; i < 256 ; ++i)
+        free((char*)colorseqs[i]);
+
+    seq = tigetstr("is1");
+    if (seq)
+        outputstring(&init, seq);
+    seq = tigetstr("is2");
+    if (seq)
+        outputstring(&init, seq);
+    seq = tigetstr("is3");
+    if (seq)
+        outputstring(&init, seq);
+    *outputspace(&init, 1) = '\0';
+    terminit = init.buf;
+}
+
+/* Prepare the terminal for color output, looking it up first if that
+ * has not already been done. (This happens before the first line is
+ * rendered, so when running as a pipeline there is as yet nothing for
+ * the writing thread to output, and the initialization strings can be
+ * written out directly.)
+ */
+static void initterminal(void)
+{
+    terminalready = 1;
+    if (!terminit)
+        lookupterminal();
+    outputstring(&stdoutput, terminit);
+    if (pool.threads)
+        writeout(&stdoutput);
+}
+
+/* Render a single line of a hexdump in the requested format.
+ */
+static void renderline(output *out, byte const *buf, int count, off_t pos)
+{
+    char *p;
+
+    p = outputspace(out, context.maxlinesize);
+    out->len = xcd_renderline(&context, p, buf, count, pos) - out->buf;
+}
+
+/*
+ * Rendering with multiple threads.
+ */
+
+/* Render all the lines stored in a job.
+ */
+static void renderjob(job *j)
+{
+    byte const *p;
+    int i;
+
+    p = j->input;
+    for (i = 0 ; i < j->rowcount ; ++i) {
+        if (j->rows[i].size) {
+            renderline(&j->out, p, j->rows[i].size, j->rows[i].pos);
+            p += j->rows[i].size;
+        } else {
+            outputstring(&j->out, "*\n");
+        }
+    }
+}
+
+/* The rendering threads' main loop: repeatedly take the oldest
+ * submitted job and render it, until no more jobs are forthcoming.
+ */
+static void *renderworker(void *unused)
+{
+    double t;
+    job *j;
+
+    (void)unused;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.taken == pool.submitted && !pool.finished)
+            pthread_cond_wait(&pool.ready, &pool.lock);
+        if (pool.taken == pool.submitted)
+            break;
+        j = &pool.jobs[pool.taken++ % pool.jobcount];
+        pthread_mutex_unlock(&pool.lock);
+        t = timenow();
+        renderjob(j);
+        t = timenow() - t;
+        pthread_mutex_lock(&pool.lock);
+        stats.rendertime += t;
+        j->done = 1;
+        pthread_cond_broadcast(&pool.rendered);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+/* The writing thread's main loop: wait for the oldest unwritten job
+ * to finish rendering, write out its contents, and make it available
+ * for reuse, until there are no more jobs.
+ */
+static void *writeworker(void *unused)
+{
+    job *j;
+
+    (void)unused;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.written == pool.submitted && !pool.finished)
+            pthread_cond_wait(&pool.rendered, &pool.lock);
+        if (pool.written == pool.submitted)
+            break;
+        j = &pool.jobs[pool.written % pool.jobcount];
+        while (!j->done)
+            pthread_cond_wait(&pool.rendered, &pool.lock);
+        pthread_mutex_unlock(&pool.lock);
+        writeall(STDOUT_FILENO, j->out.buf, j->out.len);
+        j->out.len = 0;
+        j->inputlen = 0;
+        j->rowcount = 0;
+        pthread_mutex_lock(&pool.lock);
+        j->done = 0;
+        ++pool.written;
+        pthread_cond_broadcast(&pool.freed);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+/* Create the rendering and writing threads and their jobs. Any output
+ * that is already pending is written first, since from here on only
+ * the writing thread produces output.
+ */
+static void startworkers(void)
+{
+    int i;
+
+    writeout(&stdoutput);
+    pool.jobcount = 2 * threadcount + 2;
+    pool.jobs = calloc(pool.jobcount, sizeof *pool.jobs);
+    pool.threads = calloc(threadcount + 1, sizeof *pool.threads);
+    if (!pool.jobs || !pool.threads)
+        die("out of memory");
+    for (i = 0 ; i < pool.jobcount ; ++i) {
+        pool.jobs[i].input = malloc(JOBLINES * linesize);
+        pool.jobs[i].rows = malloc(2 * JOBLINES * sizeof *pool.jobs[i].rows);
+        if (!pool.jobs[i].input || !pool.jobs[i].rows)
+            die("out of memory");
+        pool.jobs[i].out.fd = -1;
+    }
+    for (i = 0 ; i < threadcount ; ++i)
+        if (pthread_create(&pool.threads[i], NULL, renderworker, NULL))
+            die("unable to create thread: %s", strerror(errno));
+    if (pthread_create(&pool.threads[threadcount], NULL, writeworker, NULL))
+        die("unable to create thread: %s", strerror(errno));
+}
+
+/* Hand off the job currently being filled to the rendering threads,
+ * and then wait until the next job in the ring is free.
+ */
+static void submitjob(void)
+{
+    pthread_mutex_lock(&pool.lock);
+    ++pool.submitted;
+    pthread_cond_signal(&pool.ready);
+    while (pool.submitted - pool.written >= pool.jobcount)
+        pthread_cond_wait(&pool.freed, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/* Wait until all the output of the jobs submitted so far has been
+ * written, including the job currently being filled.
+ */
+static void flushjobs(void)
+{
+    if (pool.jobs[pool.submitted % pool.jobcount].rowcount)
+        submitjob();
+    pthread_mutex_lock(&pool.lock);
+    while (pool.written < pool.submitted)
+        pthread_cond_wait(&pool.freed, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+}
+
+/* Write out the remaining jobs and shut down the worker threads.
+ */
+static void stopworkers(void)
+{
+    int i;
+
+    flushjobs();
+    pthread_mutex_lock(&pool.lock);
+    pool.finished = 1;
+    pthread_cond_broadcast(&pool.ready);
+    pthread_cond_broadcast(&pool.rendered);
+    pthread_mutex_unlock(&pool.lock);
+    for (i = 0 ; i <= threadcount ; ++i)
+        pthread_join(pool.threads[i], NULL);
+    pool.threads = NULL;
+}
+
+/* Add a line (or an asterisk, if count is zero) to the job currently
+ * being filled, submitting it first if it is full.
+ */
+static void queueline(byte const *buf, int count, off_t pos)
+{
+    job *j;
+
+    j = &pool.jobs[pool.submitted % pool.jobcount];
+    if (j->rowcount == 2 * JOBLINES
+                || j->inputlen + count > JOBLINES * linesize) {
+        submitjob();
+        j = &pool.jobs[pool.submitted % pool.jobcount];
+    }
+    if (count) {
+        memcpy(j->input + j->inputlen, buf, count);
+        j->inputlen += count;
+    }
+    j->rows[j->rowcount].pos = pos;
+    j->rows[j->rowcount].size = count;
+    ++j->rowcount;
+}
+
+/*
+ * The line output functions.
+ */
+
+/* Display a single line of a hexdump appropriate in the requested
+ * format.
+ */
+static void dumpline(byte const *buf, int count, off_t pos)
+{
+    if (count) {
+        ++stats.linecount;
+        if (!terminalready)
+            initterminal();
+        xcd_assigncolors(&context, buf, count);
+        if (pool.threads)
+            queueline(buf, count, pos);
+        else
+            renderline(&stdoutput, buf, count, pos);
+    }
+}
+
+/* Display an asterisk, standing for lines that are not displayed.
+ */
+static void dumpasterisk(void)
+{
+    ++stats.linecount;
+    if (pool.threads)
+        queueline(NULL, 0, 0);
+    else
+        outputstring(&stdoutput, "*\n");
+}
+
+/* Display some hexdump lines consisting entirely of zero bytes. If
+ * count is three or more, all but the first are elided.
+ */
+static void dumpzerolines(off_t count, off_t pos)
+{
+    static byte zeroline[256];
+    int i;
+
+    if (count > 2) {
+        dumpline(zeroline, linesize, pos);
+        stats.elidedcount += count - 1;
+        dumpasterisk();
+    } else {
+        for (i = 0 ; i < count ; ++i)
+            dumpline(zeroline, linesize, pos + i * linesize);
+    }
+}
+
+/* Get the next line of input to be dumped, which is at position pos.
+ * The position is noted in case the line has to be displayed before
+ * it is complete.
+ */
+static int nextdumpline(state *s, off_t pos, byte const **line)
+{
+    s->linepos = pos;
+    return nextline(s, linesize < s->maxinputlen ? linesize
+                                                 : (int)s->maxinputlen,
+                    line);
+}
+
+/* Display hexdump lines from the given filenames until there's no
+ * more input.
+ */
+static void dumpfiles(state *s, off_t pos)
+{
+    byte const *line;
+    int n;
+
+    while (s->maxinputlen > 0) {
+        n = nextdumpline(s, pos, &line);
+        if (n == 0)
+            break;
+        s->maxinputlen -= n;
+        dumpline(line, n, pos);
+        pos += n;
+    }
+}
+
+/* Return true if the given array contains any nonzero bytes.
+ */
+static int isnonzero(byte const *buf, int count)
+{
+    return xcd_zerospan(buf, count) < (size_t)count;
+}
+
+/* Display hexdump lines from the given filenames until there's no
+ * more input. Lines are checked for the presence of nonzero bytes,
+ * and lines that are all zeroes are deferred until a nonzero byte is
+ * found. At that point, if three or more lines of zeroes were found,
+ * all but the first are omitted. If the end of input is reached while
+ * searching for a nonzero byte, then all but the first and last line
+ * are omitted. Once a line of zeroes has been seen, any immediately
+ * following zero lines are counted in bulk directly from the input
+ * buffer, rather than being retrieved one at a time.
+ */
+static void dumpfileswithautoskip(state *s, off_t pos)
+{
+    static byte zeroline[256];
+    byte const *line;
+    off_t linesheld = 0, holdpos = 0, skipped;
+    int lastheldsize = 0, n;
+
+    while (s->maxinputlen > 0) {
+        n = nextdumpline(s, pos, &line);
+        if (n == 0)
+            break;
+        s->maxinputlen -= n;
+        if (isnonzero(line, n)) {
             if (linesheld) {
                 dumpzerolines(linesheld, holdpos);
                 linesheld = 0;
             }
-            dumpline(line, n, pos);
+            dumpline(line, n, pos);
+        } else {
+            if (linesheld == 0)
+                holdpos = pos;
+            ++linesheld;
+            lastheldsize = n;
+            if (n == linesize) {
+                skipped = skipzerolines(s, s->maxinputlen / linesize);
+                linesheld += skipped;
+                s->maxinputlen -= skipped * linesize;
+                pos += skipped * linesize;
+            }
+        }
+        pos += n;
+    }
+
+    if (linesheld) {
+        dumpzerolines(linesheld - 1, holdpos);
+        dumpline(zeroline, lastheldsize, pos - lastheldsize);
+    }
+}
+
+/* Display the lines that repeat the last line displayed, of which
+ * count were found in a run. If two or more were found, they are
+ * replaced with a single asterisk.
+ */
+static void dumprepeatedlines(byte const *line, int size, off_t count,
+                              off_t pos)
+{
+    if (count > 1) {
+        stats.elidedcount += count;
+        dumpasterisk();
+    } else if (count) {
+        dumpline(line, size, pos);
+    }
+}
+
+/* Display hexdump lines from the given filenames until there's no
+ * more input, omitting runs of identical lines. This generalizes
+ * autoskip: the first line of a run is displayed, and the rest are
+ * held back until a different line is found. At that point, if two or
+ * more lines were held, they are replaced by an asterisk. At the end
+ * of input, the last line held is displayed, so that the end of the
+ * input is visible. Held lines are counted in bulk directly from the
+ * input buffer (or, for lines of zeroes, from holes in the file),
+ * rather than being retrieved one at a time.
+ */
+static void dumpfileswithdedup(state *s, off_t pos)
+{
+    byte last[256];
+    byte const *line;
+    off_t linesheld = 0, holdpos = 0, skipped;
+    int lastsize = 0, n;
+
+    while (s->maxinputlen > 0) {
+        n = nextdumpline(s, pos, &line);
+        if (n == 0)
+            break;
+        s->maxinputlen -= n;
+        if (n == lastsize && !memcmp(line, last, n)) {
+            if (linesheld == 0)
+                holdpos = pos;
+            ++linesheld;
+            if (n == linesize) {
+                if (isnonzero(last, n))
+                    skipped = skiprepeatedlines(s, last,
+                                                s->maxinputlen / linesize);
+                else
+                    skipped = skipzerolines(s, s->maxinputlen / linesize);
+                linesheld += skipped;
+                s->maxinputlen -= skipped * linesize;
+                pos += skipped * linesize;
+            }
+        } else {
+            if (linesheld) {
+                dumprepeatedlines(last, lastsize, linesheld, holdpos);
+                linesheld = 0;
+            }
+            dumpline(line, n, pos);
+            memcpy(last, line, n);
+            lastsize = n;
+        }
+        pos += n;
+    }
+
+    if (linesheld) {
+        dumprepeatedlines(last, lastsize, linesheld - 1, holdpos);
+        dumpline(last, lastsize, pos - lastsize);
+    }
+}
+
+/* Return the position of the end of the portion of the input that is
+ * to be dumped, if the total size of the input can be determined
+ * ahead of time, or MAXOFFSET if not.
+ */
+static off_t inputend(state const *s)
+{
+    struct stat st;
+    char **name;
+    off_t size, end;
+    int fd;
+
+    size = 0;
+    for (name = s->filenames ; *name && size < MAXOFFSET ; ++name) {
+        if (!strcmp(*name, "-")) {
+            if (fstat(STDIN_FILENO, &st) || !S_ISREG(st.st_mode)
+                                         || (decompress
+                                             && compression(STDIN_FILENO)))
+                st.st_size = MAXOFFSET;
+        } else if (!stat(*name, &st)) {
+            if (S_ISBLK(st.st_mode)) {
+                fd = open(*name, O_RDONLY | O_CLOEXEC);
+                st.st_size = fd < 0 ? 0 : lseek(fd, 0, SEEK_END);
+                if (fd >= 0)
+                    close(fd);
+            } else if (!S_ISREG(st.st_mode)) {
+                st.st_size = MAXOFFSET;
+            } else if (decompress
+                       && (fd = open(*name, O_RDONLY | O_CLOEXEC)) >= 0) {
+                if (compression(fd))
+                    st.st_size = MAXOFFSET;
+                close(fd);
+            }
+        } else {
+            st.st_size = 0;
+        }
+        if (st.st_size > 0)
+            size = st.st_size > MAXOFFSET - size ? MAXOFFSET
+                                                 : size + st.st_size;
+    }
+    end = s->maxinputlen < MAXOFFSET - s->startoffset ?
+                        s->startoffset + s->maxinputlen : MAXOFFSET;
+    return end < size ? end : size;
+}
+
+/* Determine how many digits are needed to display the largest file
+ * position in the dump. The total size of the input is used if it can
+ * be determined ahead of time, otherwise the eight-digit default is
+ * retained; it will still grow on demand, just without alignment.
+ */
+static void setaddresswidth(state const *s)
+{
+    off_t end;
+
+    end = inputend(s);
+    if (end == MAXOFFSET || end <= s->startoffset)
+        return;
+    for (--end, addrwidth = 8 ; addrwidth < 16 ; ++addrwidth)
+        if ((unsigned long long)end >> (4 * addrwidth) == 0)
+            break;
+}
+
+/* Return true if every input file is seekable, and thus can be read
+ * more than once.
+ */
+static int seekableinput(state const *s)
+{
+    struct stat st;
+    char **name;
+
+    for (name = s->filenames ; *name ; ++name) {
+        if (!strcmp(*name, "-")) {
+            if (fstat(STDIN_FILENO, &st))
+                return 0;
+        } else if (stat(*name, &st)) {
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) && !S_ISBLK(st.st_mode))
+            return 0;
+    }
+    return 1;
+}
+
+/* Add the occurrences of each byte value in the input, up to the
+ * limit, to counts. Holes in sparse files are skipped over, since
+ * zero's color is fixed.
+ */
+static void scanportion(state *scan, unsigned long long *counts)
+{
+    off_t skipped;
+    size_t n;
+
+    while (scan->maxinputlen > 0) {
+        if (scan->bufpos == scan->buflen && !fillbuffer(scan))
+            break;
+        skipped = skipholes(scan, scan->maxinputlen / linesize);
+        scan->maxinputlen -= skipped * linesize;
+        n = scan->buflen - scan->bufpos;
+        if ((off_t)n > scan->maxinputlen)
+            n = scan->maxinputlen;
+        if (scan->map && scan->holecheck > (off_t)scan->bufpos
+                      && scan->holecheck - (off_t)scan->bufpos < (off_t)n)
+            n = scan->holecheck - scan->bufpos;
+        xcd_countbytes(counts, scan->data + scan->bufpos, n);
+        scan->bufpos += n;
+        scan->maxinputlen -= n;
+    }
+}
+
+/* Assign colors by frequency, using the byte counts from a separate
+ * read of the portion of the input that is to be dumped: each of the
+ * selected ranges, if there are any, or else everything from the
+ * starting point up to the limit. When comparing two inputs, only the
+ * first is counted, so that the bytes the two have in common are not
+ * counted twice. The position of standard input is restored
+ * afterwards.
+ */
+static void scaninput(state const *s)
+{
+    unsigned long long counts[256] = { 0 };
+    char *names[2];
+    state scan;
+    off_t stdinpos, pos, start;
+    int i;
+
+    stdinpos = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    scan = *s;
+    scan.silent = 1;
+    scan.follow = 0;
+    if (diffmode) {
+        names[0] = s->filenames[0];
+        names[1] = NULL;
+        scan.filenames = names;
+    }
+    pos = 0;
+    for (i = 0 ; i < (rangecount ? rangecount : 1) ; ++i) {
+        start = rangecount ? ranges[i].start : s->startoffset;
+        scan.maxinputlen = rangecount ? ranges[i].end - start
+                                      : s->maxinputlen;
+        if (!skipinput(&scan, start - pos))
+            break;
+        scanportion(&scan, counts);
+        if (scan.maxinputlen > 0 || !rangecount)
+            break;
+        pos = ranges[i].end;
+    }
+    closeinput(&scan);
+    if (stdinpos >= 0)
+        lseek(STDIN_FILENO, stdinpos, SEEK_SET);
+    xcd_rankcolors(&context, counts);
+}
+
+/* Assign colors by frequency, using the byte counts from the first
+ * block of input. This is used when the input cannot be read twice.
+ */
+static void sampleinput(state *s)
+{
+    unsigned long long counts[256] = { 0 };
+    size_t n;
+
+    if (s->bufpos < s->buflen || fillbuffer(s)) {
+        n = s->buflen - s->bufpos;
+        if ((off_t)n > s->maxinputlen)
+            n = s->maxinputlen;
+        xcd_countbytes(counts, s->data + s->bufpos, n);
+    }
+    xcd_rankcolors(&context, counts);
+}
+
+/* Signal handler for SIGUSR1 when dumping the tail.
+ */
+static void requesttail(int sig)
+{
+    (void)sig;
+    tailrequested = 1;
+}
+
+/* Display the contents of the tail's ring buffer, which holds the
+ * most recent bytes out of the count bytes of input that followed
+ * position pos. The dump begins at the start of the line that contains
+ * the first of the last tailsize bytes, so that the lines fall at the
+ * same positions as they would in a complete dump. The bytes are
+ * copied out into a separate state, so that the usual dump functions
+ * can be used, and so that the ring buffer can continue to be filled
+ * afterwards.
+ */
+static void dumpring(byte const *ring, size_t ringsize, off_t count,
+                     off_t pos)
+{
+    static char *nofilenames[] = { NULL };
+    unsigned long long counts[256] = { 0 };
+    state s;
+    off_t first;
+    size_t size, at;
+
+    first = count > tailsize ? count - tailsize : 0;
+    first -= first % linesize;
+    size = count - first;
+    memset(&s, 0, sizeof s);
+    s.buf = malloc(size ? size : 1);
+    if (!s.buf)
+        die("out of memory");
+    at = first % ringsize;
+    if (at + size <= ringsize) {
+        memcpy(s.buf, ring + at, size);
+    } else {
+        memcpy(s.buf, ring + at, ringsize - at);
+        memcpy(s.buf + ringsize - at, ring, size - (ringsize - at));
+    }
+    s.filenames = nofilenames;
+    s.currentfile = -1;
+    s.nextfile = -1;
+    s.watchfd = -1;
+    s.data = s.buf;
+    s.buflen = size;
+    s.maxinputlen = size;
+
+    if (frequencypalette && context.colorsleft) {
+        xcd_countbytes(counts, s.buf, size);
+        xcd_rankcolors(&context, counts);
+    }
+    if (dedup)
+        dumpfileswithdedup(&s, pos + first);
+    else if (autoskip)
+        dumpfileswithautoskip(&s, pos + first);
+    else
+        dumpfiles(&s, pos + first);
+    free(s.buf);
+}
+
+/* Read through the input, retaining only the most recent bytes in a
+ * fixed-size ring buffer, and display them at the end. (An extra line
+ * is retained, so that the dump can start on a line boundary.) Only
+ * the final portion of each block of input is copied, so a file that
+ * is mapped into memory is mostly never touched. SIGUSR1 causes the
+ * current contents to be displayed without stopping.
+ */
+static void dumptail(state *s)
+{
+    struct sigaction sa;
+    byte const *data;
+    byte *ring;
+    size_t ringsize, at, n, m;
+    off_t count;
+
+    if (tailsize > (off_t)(SIZE_MAX / 2))
+        die("value for tail too large");
+    ringsize = (tailsize + linesize - 1) / linesize * linesize + linesize;
+    ring = malloc(ringsize);
+    if (!ring)
+        die("out of memory");
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = requesttail;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    count = 0;
+    while (s->maxinputlen > 0) {
+        if (tailrequested) {
+            tailrequested = 0;
+            dumpring(ring, ringsize, count, s->startoffset);
+            flushoutput();
+        }
+        if (s->bufpos == s->buflen && !fillbuffer(s))
+            break;
+        n = s->buflen - s->bufpos;
+        if ((off_t)n > s->maxinputlen)
+            n = s->maxinputlen;
+        data = s->data + s->bufpos;
+        s->bufpos += n;
+        s->maxinputlen -= n;
+        if (n > ringsize) {
+            data += n - ringsize;
+            count += n - ringsize;
+            n = ringsize;
+        }
+        at = count % ringsize;
+        m = n < ringsize - at ? n : ringsize - at;
+        memcpy(ring + at, data, m);
+        memcpy(ring, data + m, n - m);
+        count += n;
+    }
+    dumpring(ring, ringsize, count, s->startoffset);
+    free(ring);
+}
+
+/* Display a line from one of the two inputs being compared, preceded
+ * by marker, and with the bytes that differ from the other input's
+ * line highlighted.
+ */
+static void dumpdiffline(byte const *buf, int count, byte const *other,
+                         int othercount, off_t pos, char marker)
+{
+    char *p;
+
+    ++stats.linecount;
+    if (!terminalready)
+        initterminal();
+    xcd_assigncolors(&context, buf, count);
+    p = outputspace(&stdoutput, context.maxlinesize + 1);
+    *p++ = marker;
+    p = xcd_renderdiffline(&context, p, buf, count, other, othercount, pos);
+    stdoutput.len = p - stdoutput.buf;
+}
+
+/* Display the lines that differ between two inputs, read in lockstep.
+ * Whenever both inputs have data available in their buffers, the
+ * whole lines that they have in common are passed over in bulk. When
+ * a line differs, the first input's version is displayed, marked with
+ * a minus, followed by the second's, marked with a plus. An asterisk
+ * stands for any identical lines in between. If one input is longer,
+ * its remaining lines are displayed alone. The exit code is set if
+ * any differences are found.
+ */
+static void dumpdiff(state const *s)
+{
+    static char *names[2][2];
+    byte const *linea, *lineb;
+    state sa, sb, *a = &sa, *b = &sb;
+    off_t pos, skipped;
+    size_t n;
+    int count, na, nb, differ;
+
+    names[0][0] = s->filenames[0];
+    names[1][0] = s->filenames[1];
+    sa = *s;
+    sa.filenames = names[0];
+    sb = *s;
+    sb.filenames = names[1];
+    skipinput(a, a->startoffset);
+    skipinput(b, b->startoffset);
+    pos = a->startoffset;
+    skipped = 0;
+    differ = 0;
+    while (a->maxinputlen > 0) {
+        if (a->bufpos < a->buflen && b->bufpos < b->buflen) {
+            n = a->buflen - a->bufpos;
+            if (n > b->buflen - b->bufpos)
+                n = b->buflen - b->bufpos;
+            if ((off_t)n > a->maxinputlen)
+                n = a->maxinputlen;
+            n = matchspan(a->data + a->bufpos, b->data + b->bufpos, n);
+            n -= n % linesize;
+            if (n) {
+                a->bufpos += n;
+                b->bufpos += n;
+                a->maxinputlen -= n;
+                pos += n;
+                skipped += n / linesize;
+                stats.elidedcount += n / linesize;
+                continue;
+            }
+        }
+        count = linesize < a->maxinputlen ? linesize : (int)a->maxinputlen;
+        na = nextline(a, count, &linea);
+        nb = nextline(b, count, &lineb);
+        if (na == 0 && nb == 0)
+            break;
+        count = na > nb ? na : nb;
+        a->maxinputlen -= count;
+        if (na == nb && !memcmp(linea, lineb, na)) {
+            ++skipped;
+            ++stats.elidedcount;
+            pos += count;
+            continue;
+        }
+        if (skipped) {
+            outputstring(&stdoutput, "*\n");
+            ++stats.linecount;
+            skipped = 0;
+        }
+        if (na)
+            dumpdiffline(linea, na, lineb, nb, pos, '-');
+        if (nb)
+            dumpdiffline(lineb, nb, linea, na, pos, '+');
+        differ = 1;
+        pos += count;
+    }
+    closeinput(a);
+    closeinput(b);
+    if (differ && !exitcode)
+        exitcode = 1;
+}
+
+/*
+ * Searching the input.
+ */
+
+/* Display the lines that lie before want and have not yet been
+ * displayed or passed over, taking their bytes from the current chunk
+ * and the input preceding it. Unless the end of the input has been
+ * reached, a line is only displayed once all of its bytes are
+ * available.
+ */
+static void showlines(search *f, off_t want, int atend)
+{
+    byte line[256];
+    byte const *p;
+    off_t end;
+    size_t n;
+    int count;
+
+    end = f->pos + f->chunklen;
+    if (want > end)
+        want = end;
+    while (f->next < want) {
+        count = linesize;
+        if (f->next + count > end) {
+            if (!atend)
+                break;
+            count = end - f->next;
+        }
+        if (f->next >= f->pos) {
+            p = f->chunk + (f->next - f->pos);
+        } else {
+            n = f->pos - f->next;
+            memcpy(line, f->hist + f->histlen - n,
+                   n < (size_t)count ? n : (size_t)count);
+            if (n < (size_t)count)
+                memcpy(line + n, f->chunk, count - n);
+            p = line;
+        }
+        dumpline(p, count, f->next);
+        f->next += count;
+        f->shown = 1;
+    }
+}
+
+/* Note a match found at the given file position. The lines holding
+ * the match and its context are added to the lines to be displayed.
+ * If they don't adjoin the lines of the previous match, those lines
+ * are displayed first, and an asterisk marks the ones passed over.
+ */
+static void foundmatch(search *f, off_t pos)
+{
+    off_t first, last;
+
+    first = pos - (pos - f->base) % linesize - (off_t)contextlines * linesize;
+    if (first < f->base)
+        first = f->base;
+    pos += findlen - 1;
+    last = pos - (pos - f->base) % linesize
+               + (off_t)(contextlines + 1) * linesize;
+    if (first > f->want) {
+        showlines(f, f->want, 0);
+        if (f->shown)
+            dumpasterisk();
+        f->next = first;
+    }
+    if (last > f->want)
+        f->want = last;
+}
+
+/* Move the current chunk into the search's history, retaining as much
+ * of the input before it as still fits.
+ */
+static void keephistory(search *f)
+{
+    size_t n;
+
+    if (f->chunklen >= f->histsize) {
+        memcpy(f->hist, f->chunk + f->chunklen - f->histsize, f->histsize);
+        f->histlen = f->histsize;
+    } else {
+        n = f->histsize - f->chunklen;
+        if (f->histlen > n) {
+            memmove(f->hist, f->hist + f->histlen - n, n);
+            f->histlen = n;
+        }
+        memcpy(f->hist + f->histlen, f->chunk, f->chunklen);
+        f->histlen += f->chunklen;
+    }
+    f->pos += f->chunklen;
+    f->chunk = NULL;
+    f->chunklen = 0;
+}
+
+/* Display only the lines of the input that contain the byte sequence
+ * being searched for, along with the requested lines of context. Each
+ * block of input (or an entire mapped file) is searched in one pass
+ * with memmem(), so the lines in between are never looked at
+ * individually. A match that spans two blocks is found by comparing
+ * the bytes around the boundary separately. The return value is
+ * false if no matches are found.
+ */
+static int dumpmatches(state *s, off_t pos)
+{
+    search f;
+    byte *seam;
+    byte const *p, *end;
+    size_t n, m, i;
+
+    f.base = f.next = f.want = f.pos = pos;
+    f.chunk = NULL;
+    f.chunklen = 0;
+    f.histsize = (size_t)(contextlines + 2) * linesize + findlen;
+    f.histlen = 0;
+    f.shown = 0;
+    f.hist = malloc(f.histsize);
+    seam = malloc(2 * findlen);
+    if (!f.hist || !seam)
+        die("out of memory");
+
+    while (s->maxinputlen > 0) {
+        if (s->bufpos == s->buflen && !fillbuffer(s))
+            break;
+        f.chunk = s->data + s->bufpos;
+        f.chunklen = s->buflen - s->bufpos;
+        if ((off_t)f.chunklen > s->maxinputlen)
+            f.chunklen = s->maxinputlen;
+        s->bufpos += f.chunklen;
+        s->maxinputlen -= f.chunklen;
+        if (findlen > 1 && f.histlen) {
+            n = f.histlen < findlen - 1 ? f.histlen : findlen - 1;
+            m = f.chunklen < findlen - 1 ? f.chunklen : findlen - 1;
+            memcpy(seam, f.hist + f.histlen - n, n);
+            memcpy(seam + n, f.chunk, m);
+            for (i = 0 ; i < n && i + findlen <= n + m ; ++i)
+                if (!memcmp(seam + i, findpattern, findlen))
+                    foundmatch(&f, f.pos - n + i);
+        }
+        end = f.chunk + f.chunklen;
+        for (p = f.chunk ; (p = memmem(p, end - p, findpattern, findlen)) ;
+                           ++p)
+            foundmatch(&f, f.pos + (p - f.chunk));
+        showlines(&f, f.want, 0);
+        keephistory(&f);
+    }
+    showlines(&f, f.want, 1);
+
+    free(seam);
+    free(f.hist);
+    return f.shown;
+}
+
+/*
+ * The overview.
+ */
+
+/* Summarize a block of input of the given size from the counts of its
+ * byte values. Its glyph is its entropy in bits per byte, rounded to
+ * a digit, or a dot if the block is all zero bytes.
+ */
+static cell summarize(unsigned long long const *counts, size_t size)
+{
+    cell c;
+    double e, p;
+    int i;
+
+    c.value = 0;
+    e = 0;
+    for (i = 0 ; i < 256 ; ++i) {
+        if (counts[i] > counts[c.value])
+            c.value = i;
+        if (counts[i]) {
+            p = (double)counts[i] / size;
+            e -= p * log2(p);
+        }
+    }
+    c.glyph = counts[0] == size ? '.' : '0' + (int)(e + 0.5);
+    return c;
+}
+
+/* Summarize each of the blocks in a run. This is the main function
+ * of the threads that divide up a batch of blocks.
+ */
+static void *summarizerun(void *arg)
+{
+    blockrun *run = arg;
+    unsigned long long counts[256];
+    size_t i;
+
+    for (i = 0 ; i < run->count ; ++i) {
+        memset(counts, 0, sizeof counts);
+        xcd_countbytes(counts, run->data + i * overviewblock, overviewblock);
+        run->cells[i] = summarize(counts, overviewblock);
+    }
+    return NULL;
+}
+
+/* Summarize a batch of consecutive whole blocks, dividing them among
+ * the requested number of threads.
+ */
+static void summarizebatch(byte const *data, size_t count, cell *cells)
+{
+    pthread_t threads[OVERVIEWBATCH];
+    blockrun runs[OVERVIEWBATCH];
+    size_t per, n, i;
+
+    per = (count + threadcount - 1) / threadcount;
+    n = (count + per - 1) / per;
+    for (i = 0 ; i < n ; ++i) {
+        runs[i].data = data + i * per * overviewblock;
+        runs[i].count = count - i * per < per ? count - i * per : per;
+        runs[i].cells = cells + i * per;
+    }
+    for (i = 1 ; i < n ; ++i)
+        if (pthread_create(&threads[i], NULL, summarizerun, &runs[i]))
+            die("unable to create thread: %s", strerror(errno));
+    summarizerun(&runs[0]);
+    for (i = 1 ; i < n ; ++i)
+        pthread_join(threads[i], NULL);
+}
+
+/* Display a row of the overview, with pos giving the position of the
+ * first block in the row. Each block's cell is displayed in the color
+ * of its most common byte value, as it would be in the dump.
+ */
+static void dumpcells(cell const *cells, int count, off_t pos)
+{
+    char *p;
+    int current, color, i;
+
+    if (!count)
+        return;
+    if (!terminalready)
+        initterminal();
+    p = outputspace(&stdoutput, 24 + count * (XCD_MAXSEQLEN + 1)
+                                   + XCD_MAXSEQLEN);
+    p += sprintf(p, "%0*llX: ", addrwidth, (unsigned long long)pos);
+    current = -1;
+    for (i = 0 ; i < count ; ++i) {
+        if (colorize) {
+            xcd_assigncolors(&context, &cells[i].value, 1);
+            color = context.palette[cells[i].value];
+            if (color != current) {
+                memcpy(p, context.colorseqs[color],
+                       context.colorseqlens[color]);
+                p += context.colorseqlens[color];
+                current = color;
+            }
+        }
+        *p++ = cells[i].glyph;
+    }
+    if (colorize) {
+        memcpy(p, context.sgr0, context.sgr0len);
+        p += context.sgr0len;
+    }
+    *p++ = '\n';
+    stdoutput.len = p - stdoutput.buf;
+    ++stats.linecount;
+}
+
+/* Display an overview of the input instead of a dump: the input is
+ * divided into blocks, and each block is summarized as a single cell,
+ * with OVERVIEWCELLS cells to a row. Whole blocks lying within the
+ * input buffer (or a file mapping) are summarized in batches, divided
+ * among the rendering threads; blocks that straddle the buffer are
+ * counted piecemeal as the input arrives. When no block size was
+ * given, one is chosen so that the overview of input of known size
+ * fills no more than a few dozen rows.
+ */
+static void dumpoverview(state *s)
+{
+    unsigned long long counts[256];
+    cell row[OVERVIEWCELLS], batch[OVERVIEWBATCH];
+    off_t pos, size, held;
+    size_t n, k, i;
+    int rowlen;
+
+    if (!overviewblock) {
+        size = inputend(s);
+        overviewblock = 65536;
+        if (size != MAXOFFSET) {
+            size -= s->startoffset;
+            overviewblock = 4096;
+            while (size / overviewblock >= 32 * OVERVIEWCELLS)
+                overviewblock *= 2;
+        }
+    }
+
+    pos = s->startoffset;
+    rowlen = 0;
+    held = 0;
+    memset(counts, 0, sizeof counts);
+    while (s->maxinputlen > 0) {
+        if (s->bufpos == s->buflen && !fillbuffer(s))
+            break;
+        n = s->buflen - s->bufpos;
+        if ((off_t)n > s->maxinputlen)
+            n = s->maxinputlen;
+        if (held || (off_t)n < overviewblock) {
+            if ((off_t)n > overviewblock - held)
+                n = overviewblock - held;
+            xcd_countbytes(counts, s->data + s->bufpos, n);
+            held += n;
+            k = 0;
+            if (held == overviewblock) {
+                batch[k++] = summarize(counts, held);
+                memset(counts, 0, sizeof counts);
+                held = 0;
+            }
         } else {
-            if (linesheld == 0)
-                holdpos = pos;
-            ++linesheld;
-            lastheldsize = n;
+            k = n / overviewblock;
+            if (k > OVERVIEWBATCH)
+                k = OVERVIEWBATCH;
+            n = k * overviewblock;
+            summarizebatch(s->data + s->bufpos, k, batch);
+        }
+        s->bufpos += n;
+        s->maxinputlen -= n;
+        for (i = 0 ; i < k ; ++i) {
+            row[rowlen++] = batch[i];
+            if (rowlen == OVERVIEWCELLS) {
+                dumpcells(row, rowlen, pos);
+                pos += (off_t)rowlen * overviewblock;
+                rowlen = 0;
+            }
         }
-        pos += n;
     }
+    if (held)
+        row[rowlen++] = summarize(counts, held);
+    dumpcells(row, rowlen, pos);
+}
 
-    if (linesheld) {
-        dumpzerolines(linesheld - 1, holdpos);
-        dumpline(line, lastheldsize, pos - lastheldsize);
+/*
+ * Reversing a dump.
+ */
+
+/* The value of each hexadecimal digit, indexed by character, or -1.
+ */
+static signed char hexvalues[256];
+
+/* Return a pointer past any terminal control sequences at p, such
+ * as those that select colors, without going past end.
+ */
+static char const *skipsequences(char const *p, char const *end)
+{
+    while (p < end && *p == '\33') {
+        if (p + 1 < end && p[1] == '[') {
+            for (p += 2 ; p < end && (*p < 0x40 || *p > 0x7E) ; ++p) ;
+            ++p;
+        } else if (p + 1 < end && (p[1] == '(' || p[1] == ')')) {
+            p += 3;
+        } else {
+            p += 2;
+        }
     }
+    return p < end ? p : end;
 }
 
-/* Move the input stream to the starting point and then 
+/* Write count bytes of output, consisting of the given line of size
+ * bytes repeated as many times (or partially) as needed.
  */
-static void dump(state *s)
+static void outputrepeats(byte const *line, int size, off_t count)
+{
+    char *p;
+    int n;
+
+    while (count > 0) {
+        n = count < size ? (int)count : size;
+        p = outputspace(&stdoutput, n);
+        memcpy(p, line, n);
+        stdoutput.len += n;
+        count -= n;
+    }
+}
+
+/* Fill the gap in the output before pos with count bytes, consisting
+ * of repetitions of the given line of size bytes. A gap of zero bytes
+ * that is larger than the output buffer is seeked over instead, when
+ * the output is a regular file, leaving a hole. Otherwise, gaps too
+ * large to be sensibly written out are an error.
+ */
+static void fillgap(reversal const *r, byte const *line, int size,
+                    off_t count, off_t pos)
 {
-    int pos;
+    if (r->seekable && count >= OUTPUTBUFSIZE && !isnonzero(line, size)) {
+        writeout(&stdoutput);
+        if (lseek(STDOUT_FILENO, count, SEEK_CUR) < 0)
+            die("cannot seek to %llX in the output: %s",
+                (long long)pos, strerror(errno));
+        return;
+    }
+    if (count > MAXREVERSEGAP)
+        die("gap of %lld bytes before %llX is too large to fill",
+            (long long)count, (long long)pos);
+    outputrepeats(line, size, count);
+}
 
-    for (pos = 0 ; pos < s->startoffset ; ++pos)
-        if (nextbyte(s) == EOF)
-	    return;
+/* Decode one line of a hexdump and write out its bytes. The line
+ * begins with the file position, followed by a colon, then the bytes'
+ * hex values, in groups separated by single spaces; the text column
+ * follows two spaces later and is ignored. Control sequences are
+ * skipped wherever they appear. Any gap before the line's
+ * position is filled: with copies of the last line, if an asterisk
+ * was seen, and otherwise with zero bytes. Lines that are not part of
+ * a dump, or whose position does not fit in a file offset, are ignored.
+ */
+static void reverseline(reversal *r, char const *line, size_t len)
+{
+    static byte const zeroline[256];
+    char const *p, *end;
+    off_t pos;
+    int count, hi, lo;
 
-    if (autoskip)
-        dumpfileswithautoskip(s, pos);
+    end = line + len;
+    p = skipsequences(line, end);
+    if (p < end && *p == '*') {
+        r->repeat = 1;
+        return;
+    }
+    line = p;
+    for (pos = 0 ; p < end && hexvalues[(byte)*p] >= 0 ; ++p) {
+        if (p - line == 16 || pos > (MAXOFFSET - hexvalues[(byte)*p]) / 16)
+            return;
+        pos = pos * 16 + hexvalues[(byte)*p];
+    }
+    if (p == line || p == end || *p != ':')
+        return;
+    ++p;
+    count = 0;
+    while (count < 256) {
+        p = skipsequences(p, end);
+        if (p < end && *p == ' ')
+            p = skipsequences(p + 1, end);
+        if (end - p < 2)
+            break;
+        hi = hexvalues[(byte)p[0]];
+        lo = hexvalues[(byte)p[1]];
+        if (hi < 0 || lo < 0)
+            break;
+        r->line[count++] = hi << 4 | lo;
+        p += 2;
+    }
+    if (!count)
+        return;
+
+    if (pos < r->pos)
+        die("dump positions are out of order at %llX", (long long)pos);
+    if (r->repeat && r->lastcount)
+        fillgap(r, r->last, r->lastcount, pos - r->pos, pos);
     else
-        dumpfiles(s, pos);
+        fillgap(r, zeroline, sizeof zeroline, pos - r->pos, pos);
+    outputrepeats(r->line, count, count);
+    memcpy(r->last, r->line, count);
+    r->lastcount = count;
+    r->repeat = 0;
+    r->pos = pos + count;
+    ++stats.linecount;
+}
+
+/* Turn a hexdump back into the binary data it was made from, which is
+ * written to standard output. The dump may be colored, and may have
+ * been made with any line and group sizes. The input is scanned for
+ * line breaks a block at a time, with lines decoded directly from the
+ * input buffer except when they span two blocks.
+ */
+static void reversedump(state *s)
+{
+    struct stat st;
+    reversal r;
+    char *text;
+    byte const *p, *nl;
+    size_t textlen, textsize, n;
+    int i;
+
+    memset(hexvalues, -1, sizeof hexvalues);
+    for (i = 0 ; i < 10 ; ++i)
+        hexvalues['0' + i] = i;
+    for (i = 0 ; i < 6 ; ++i)
+        hexvalues['A' + i] = hexvalues['a' + i] = 10 + i;
+    memset(&r, 0, sizeof r);
+    r.seekable = !fstat(STDOUT_FILENO, &st) && S_ISREG(st.st_mode)
+                        && !(fcntl(STDOUT_FILENO, F_GETFL) & O_APPEND);
+    text = NULL;
+    textlen = textsize = 0;
+    for (;;) {
+        if (s->bufpos == s->buflen && !fillbuffer(s))
+            break;
+        p = s->data + s->bufpos;
+        n = s->buflen - s->bufpos;
+        nl = memchr(p, '\n', n);
+        if (nl)
+            n = nl - p;
+        if (textlen || !nl) {
+            if (textlen + n > textsize) {
+                textsize = 2 * (textlen + n);
+                text = realloc(text, textsize);
+                if (!text)
+                    die("out of memory");
+            }
+            memcpy(text + textlen, p, n);
+            textlen += n;
+        }
+        s->bufpos += n;
+        if (!nl)
+            continue;
+        ++s->bufpos;
+        if (textlen) {
+            reverseline(&r, text, textlen);
+            textlen = 0;
+        } else {
+            reverseline(&r, (char const*)p, n);
+        }
+    }
+    if (textlen)
+        reverseline(&r, text, textlen);
+    free(text);
+}
+
+/*
+ * The interactive pager.
+ */
+
+/* The commands understood by the pager, and the keys that invoke
+ * them. The escape sequences cover the usual cursor and editing keys
+ * in both of their common forms.
+ */
+static struct { char const *key; int cmd; } const pagerkeys[] = {
+    { "q", 'q' }, { "Q", 'q' }, { "\3", 'q' },
+    { "j", 'j' }, { "e", 'j' }, { "\n", 'j' }, { "\r", 'j' },
+    { "\33[B", 'j' }, { "\33OB", 'j' },
+    { "k", 'k' }, { "y", 'k' }, { "\33[A", 'k' }, { "\33OA", 'k' },
+    { " ", 'f' }, { "f", 'f' }, { "\6", 'f' }, { "\33[6~", 'f' },
+    { "b", 'b' }, { "\2", 'b' }, { "\33[5~", 'b' },
+    { "g", 'g' }, { "<", 'g' }, { "\33[H", 'g' }, { "\33OH", 'g' },
+    { "\33[1~", 'g' },
+    { "G", 'G' }, { ">", 'G' }, { "\33[F", 'G' }, { "\33OF", 'G' },
+    { "\33[4~", 'G' },
+    { ":", ':' }
+};
+
+/* The terminal settings in effect before the pager started, and the
+ * descriptor used to read keystrokes.
+ */
+static struct termios savedtty;
+static int ttyfd = -1;
+
+/* The terminal settings used by the pager, and the sequences that
+ * switch to and from the alternate screen, kept so that a signal
+ * handler can leave and re-enter the pager's screen.
+ */
+static struct termios pagertty;
+static char const *smcup = NULL;
+static char const *rmcup = NULL;
+
+/* Set when the terminal window changes size.
+ */
+static volatile sig_atomic_t resized = 0;
+
+/* Signal handler for SIGWINCH.
+ */
+static void noteresize(int sig)
+{
+    (void)sig;
+    resized = 1;
+}
+
+/* Signal handler for SIGINT, SIGQUIT, SIGTERM, and SIGTSTP. The
+ * terminal is put back the way it was found, using only calls that
+ * are safe in a signal handler, and the signal's default action is
+ * taken. If that stopped the program, then once it is continued, the
+ * pager's settings are reinstated and the screen is redrawn.
+ */
+static void leavepager(int sig)
+{
+    struct sigaction sa;
+    sigset_t mask;
+    int err = errno;
+
+    if (rmcup)
+        write(STDOUT_FILENO, rmcup, strlen(rmcup));
+    tcsetattr(ttyfd, TCSAFLUSH, &savedtty);
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = SIG_DFL;
+    sigemptyset(&sa.sa_mask);
+    sigaction(sig, &sa, NULL);
+    sigemptyset(&mask);
+    sigaddset(&mask, sig);
+    sigprocmask(SIG_UNBLOCK, &mask, NULL);
+    raise(sig);
+    sa.sa_handler = leavepager;
+    sigaction(sig, &sa, NULL);
+    tcsetattr(ttyfd, TCSAFLUSH, &pagertty);
+    if (smcup)
+        write(STDOUT_FILENO, smcup, strlen(smcup));
+    resized = 1;
+    errno = err;
+}
+
+/* Look up a terminfo string capability, returning NULL if the terminal
+ * lacks it.
+ */
+static char const *getcap(char const *name)
+{
+    char const *str;
+
+    str = tigetstr(name);
+    return str == (char*)-1 ? NULL : str;
+}
+
+/* Put the terminal back the way it was found. This is called at exit.
+ */
+static void restoreterminal(void)
+{
+    if (ttyfd < 0)
+        return;
+    if (rmcup)
+        outputstring(&stdoutput, rmcup);
+    writeout(&stdoutput);
+    tcsetattr(ttyfd, TCSAFLUSH, &savedtty);
+    ttyfd = -1;
+}
+
+/* Set up the terminal for the pager: keystrokes are read one at a time
+ * from the controlling terminal without being echoed, and the output
+ * goes to the alternate screen, if there is one. The keys that
+ * generate signals keep working, with the terminal being restored
+ * before the signal takes effect.
+ */
+static void initpager(void)
+{
+    static int const stopsigs[] = { SIGINT, SIGQUIT, SIGTERM, SIGTSTP };
+    struct sigaction sa;
+    int err;
+    size_t i;
+
+    if (setupterm(NULL, STDOUT_FILENO, &err) != 0)
+        die("cannot identify terminal type.");
+    ttyfd = open("/dev/tty", O_RDONLY | O_CLOEXEC);
+    if (ttyfd < 0 || tcgetattr(ttyfd, &savedtty))
+        die("/dev/tty: %s", strerror(errno));
+    pagertty = savedtty;
+    pagertty.c_lflag &= ~(ICANON | ECHO);
+    pagertty.c_cc[VMIN] = 1;
+    pagertty.c_cc[VTIME] = 0;
+    smcup = getcap("smcup");
+    rmcup = getcap("rmcup");
+    memset(&sa, 0, sizeof sa);
+    sa.sa_handler = leavepager;
+    sigemptyset(&sa.sa_mask);
+    for (i = 0 ; i < sizeof stopsigs / sizeof *stopsigs ; ++i)
+        sigaction(stopsigs[i], &sa, NULL);
+    if (tcsetattr(ttyfd, TCSAFLUSH, &pagertty))
+        die("/dev/tty: %s", strerror(errno));
+    atexit(restoreterminal);
+    if (smcup)
+        outputstring(&stdoutput, smcup);
+    sa.sa_handler = noteresize;
+    sigaction(SIGWINCH, &sa, NULL);
+}
+
+/* Return the number of rows on the screen.
+ */
+static int screenheight(void)
+{
+    struct winsize ws;
+    int height;
+
+    if (!ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) && ws.ws_row > 0)
+        return ws.ws_row;
+    height = tigetnum("lines");
+    return height > 1 ? height : 24;
+}
+
+/* Move the cursor to the start of the bottom row of the screen and
+ * clear it.
+ */
+static void gotostatusline(int height)
+{
+    char const *str;
+
+    str = getcap("cup");
+    if (str)
+        outputstring(&stdoutput, tiparm(str, height - 1, 0));
+    str = getcap("el");
+    if (str)
+        outputstring(&stdoutput, str);
+}
+
+/* Draw a screenful of the dump, starting top bytes into the dumped
+ * portion of the input, which is size bytes long. Only the lines that
+ * fit on the screen are read and rendered, via a copy of the initial
+ * input state that is positioned directly at the top line. The bottom
+ * row shows the range of addresses displayed.
+ */
+static void drawscreen(state const *base, off_t top, off_t size, int height,
+                       off_t stdinpos)
+{
+    char status[128];
+    byte const *line;
+    char const *str;
+    state view;
+    off_t pos;
+    int n, i;
+
+    str = getcap("clear");
+    if (str)
+        outputstring(&stdoutput, str);
+    view = *base;
+    view.silent = 1;
+    if (stdinpos >= 0)
+        lseek(STDIN_FILENO, stdinpos, SEEK_SET);
+    pos = top;
+    if (skipinput(&view, base->startoffset + top)) {
+        for (i = 0 ; i < height - 1 && pos < size ; ++i) {
+            n = nextline(&view, linesize < size - pos ? linesize
+                                                      : (int)(size - pos),
+                         &line);
+            if (n == 0)
+                break;
+            dumpline(line, n, base->startoffset + pos);
+            pos += n;
+        }
+    }
+    closeinput(&view);
+    gotostatusline(height);
+    sprintf(status, "%0*llX-%0*llX of %llX  (q: quit, :: go to address)",
+            addrwidth, (unsigned long long)(base->startoffset + top),
+            addrwidth, (unsigned long long)(base->startoffset + pos),
+            (unsigned long long)(base->startoffset + size));
+    outputstring(&stdoutput, status);
+    writeout(&stdoutput);
+}
+
+/* Read a keystroke, or the escape sequence generated by one, and
+ * return the pager command that it invokes. Zero is returned if the
+ * key has no meaning or if the read was interrupted.
+ */
+static int readcommand(void)
+{
+    char key[16];
+    ssize_t n;
+    size_t i;
+
+    n = read(ttyfd, key, sizeof key - 1);
+    if (n == 0)
+        return 'q';
+    if (n < 0)
+        return errno == EINTR ? 0 : 'q';
+    key[n] = '\0';
+    for (i = 0 ; i < sizeof pagerkeys / sizeof *pagerkeys ; ++i)
+        if (!strcmp(key, pagerkeys[i].key))
+            return pagerkeys[i].cmd;
+    return 0;
+}
+
+/* Prompt for an address on the bottom row and return it, or -1 if the
+ * user cancels or enters something that isn't a hexadecimal number.
+ */
+static off_t readaddress(int height)
+{
+    char buf[24];
+    char *end;
+    unsigned long long addr;
+    int len;
+    char ch;
+
+    gotostatusline(height);
+    outputstring(&stdoutput, "Go to address: ");
+    writeout(&stdoutput);
+    len = 0;
+    for (;;) {
+        if (read(ttyfd, &ch, 1) != 1)
+            return -1;
+        if (ch == '\n' || ch == '\r')
+            break;
+        if (ch == '\33' || ch == '\3')
+            return -1;
+        if ((ch == '\b' || ch == '\177') && len > 0) {
+            --len;
+            writeall(STDOUT_FILENO, "\b \b", 3);
+        } else if (isxdigit((byte)ch) || ch == 'x' || ch == 'X') {
+            if (len < (int)sizeof buf - 1) {
+                buf[len++] = ch;
+                writeall(STDOUT_FILENO, &ch, 1);
+            }
+        }
+    }
+    buf[len] = '\0';
+    addr = strtoull(buf, &end, 16);
+    if (!len || *end || addr > (unsigned long long)MAXOFFSET)
+        return -1;
+    return (off_t)addr;
+}
+
+/* Run the interactive pager over the portion of the input selected to
+ * be dumped, which must be of a known size. Nothing but the current
+ * screenful is ever rendered, and moving to a new position (even the
+ * very end) simply starts reading the input there.
+ */
+static void pager(state const *s)
+{
+    off_t size, top, bottom, addr, stdinpos;
+    int height, cmd;
+
+    size = inputend(s);
+    if (size == MAXOFFSET)
+        die("cannot use --pager on input of unknown size.");
+    size = size > s->startoffset ? size - s->startoffset : 0;
+    stdinpos = lseek(STDIN_FILENO, 0, SEEK_CUR);
+    initpager();
+    top = 0;
+    cmd = 0;
+    while (cmd != 'q') {
+        height = screenheight();
+        bottom = size > 0 ? (size - 1) / linesize * linesize : 0;
+        bottom -= (off_t)(height - 2) * linesize;
+        if (bottom < 0)
+            bottom = 0;
+        if (top > bottom)
+            top = bottom;
+        if (top < 0)
+            top = 0;
+        drawscreen(s, top, size, height, stdinpos);
+        resized = 0;
+        do
+            cmd = readcommand();
+        while (!cmd && !resized);
+        switch (cmd) {
+          case 'j':     top += linesize;                            break;
+          case 'k':     top -= linesize;                            break;
+          case 'f':     top += (off_t)(height - 1) * linesize;      break;
+          case 'b':     top -= (off_t)(height - 1) * linesize;      break;
+          case 'g':     top = 0;                                    break;
+          case 'G':     top = bottom;                               break;
+          case ':':
+            addr = readaddress(height);
+            if (addr >= s->startoffset)
+                top = (addr - s->startoffset) / linesize * linesize;
+            break;
+        }
+    }
 }
 
 /*
  * The top-level functions.
  */
 
+/* Display the input up to the limit in the requested format, with
+ * pos giving the position of its first byte. The return value is
+ * false if a search found nothing to display.
+ */
+static int dumpportion(state *s, off_t pos)
+{
+    if (findpattern)
+        return dumpmatches(s, pos);
+    if (dedup)
+        dumpfileswithdedup(s, pos);
+    else if (autoskip)
+        dumpfileswithautoskip(s, pos);
+    else
+        dumpfiles(s, pos);
+    return 1;
+}
+
+/* Display each of the selected ranges of the input in turn, skipping
+ * over the input in between (by seeking, when possible), with an
+ * asterisk marking each gap. The input is already positioned at the
+ * start of the first range. The return value is as for dumpportion().
+ */
+static int dumpranges(state *s)
+{
+    off_t pos;
+    int found, i;
+
+    found = 0;
+    pos = ranges[0].start;
+    for (i = 0 ; i < rangecount ; ++i) {
+        if (i) {
+            if (!skipinput(s, ranges[i].start - pos))
+                break;
+            if (s->bufpos == s->buflen && !fillbuffer(s))
+                break;
+            if (!findpattern)
+                dumpasterisk();
+        }
+        s->maxinputlen = ranges[i].end - ranges[i].start;
+        found |= dumpportion(s, ranges[i].start);
+        if (s->maxinputlen > 0)
+            break;
+        pos = ranges[i].end;
+    }
+    return found;
+}
+
+/* Move the input stream to the starting point and then display the
+ * hexdump. The exit code is set if a search finds nothing.
+ */
+static void dump(state *s)
+{
+    int found;
+
+    if (reversemode) {
+        reversedump(s);
+        return;
+    }
+    if (frequencypalette && context.colorsleft && !tailsize
+                         && seekableinput(s))
+        scaninput(s);
+    if (diffmode) {
+        dumpdiff(s);
+        return;
+    }
+    if (pagermode && isatty(STDOUT_FILENO)) {
+        pager(s);
+        return;
+    }
+    if (!skipinput(s, s->startoffset))
+        return;
+    if (tailsize) {
+        dumptail(s);
+        return;
+    }
+    if (frequencypalette && context.colorsleft)
+        sampleinput(s);
+
+    if (overview) {
+        dumpoverview(s);
+        return;
+    }
+    found = rangecount ? dumpranges(s) : dumpportion(s, s->startoffset);
+    if (!found && !exitcode)
+        exitcode = 1;
+}
+
+
+/* Return the name of the file that holds the dump of the given input
+ * file in batch mode: the input file's name, less any leading slashes,
+ * with a .hex suffix, inside the output directory. Any directories
+ * that it lies in are created as needed. A name with a ".." in it
+ * could lead outside of the output directory, and so is refused. The
+ * return value is NULL, after an error message has been displayed,
+ * if the name cannot be used.
+ */
+static char *outputpath(char const *name)
+{
+    char const *p;
+    char *path, *q;
+
+    for (p = name ; *p ; p = *q ? q + 1 : q) {
+        q = strchrnul(p, '/');
+        if (q - p == 2 && p[0] == '.' && p[1] == '.') {
+            fprintf(stderr, "%s: path contains \"..\" and cannot be placed"
+                            " in %s\n", name, outputdir);
+            return NULL;
+        }
+    }
+    while (*name == '/')
+        ++name;
+    path = malloc(strlen(outputdir) + strlen(name) + 6);
+    if (!path)
+        die("out of memory");
+    sprintf(path, "%s/%s.hex", outputdir, name);
+    for (q = path + strlen(outputdir) + 1 ; (q = strchr(q, '/')) ; ++q) {
+        *q = '\0';
+        if (mkdir(path, 0777) && errno != EEXIST) {
+            perror(path);
+            free(path);
+            return NULL;
+        }
+        *q = '/';
+    }
+    return path;
+}
+
+/* Dump a single input file of a batch to its own output file, as if
+ * it were the only input. The palette and the address width are
+ * chosen afresh for each file.
+ */
+static void dumpone(state const *base, char *name)
+{
+    char *names[2];
+    char *path;
+    state s;
+    int fd;
+
+    s = *base;
+    names[0] = name;
+    names[1] = NULL;
+    s.filenames = names;
+    if (access(name, R_OK)) {
+        fail(&s);
+        return;
+    }
+    path = outputpath(name);
+    if (!path) {
+        exitcode = EXIT_FAILURE;
+        return;
+    }
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if (fd < 0) {
+        perror(path);
+        exitcode = EXIT_FAILURE;
+        free(path);
+        return;
+    }
+    stdoutput.fd = fd;
+    xcd_reset(&context);
+    terminalready = !colorize;
+    addrwidth = 8;
+    setaddresswidth(&s);
+    xcd_setaddrwidth(&context, addrwidth);
+    dump(&s);
+    writeout(&stdoutput);
+    closeinput(&s);
+    if (close(fd)) {
+        perror(path);
+        exitcode = EXIT_FAILURE;
+    }
+    free(path);
+}
+
+/* The main loop of a batch worker process: repeatedly claim the next
+ * input file that no worker has yet taken, using the counter shared
+ * among the workers, and dump it. If statsfd is a valid descriptor,
+ * the worker's statistics are written to it at the end, bypassing
+ * writeall() so that they are not counted as output themselves.
+ */
+static void batchworker(state const *s, int count, long *next, int statsfd)
+{
+    struct statistics snapshot;
+    char const *p;
+    double t;
+    ssize_t n;
+    size_t done;
+    long i;
+
+    t = timenow();
+    threadcount = 1;
+    while ((i = __atomic_fetch_add(next, 1, __ATOMIC_RELAXED)) < count)
+        dumpone(s, s->filenames[i]);
+    if (statsfd >= 0) {
+        snapshot = stats;
+        snapshot.rendertime = timenow() - t - snapshot.inputtime
+                                            - snapshot.outputtime;
+        if (snapshot.rendertime < 0)
+            snapshot.rendertime = 0;
+        p = (char const*)&snapshot;
+        for (done = 0 ; done < sizeof snapshot ; done += n) {
+            n = write(statsfd, p + done, sizeof snapshot - done);
+            if (n < 0) {
+                if (errno != EINTR)
+                    break;
+                n = 0;
+            }
+        }
+    }
+}
+
+/* Dump each of the input files separately, into the output directory.
+ * The files are divided among a pool of worker processes, one per
+ * thread requested, which are forked once the terminal has been
+ * looked up, so that they all share the one setup. The exit code is
+ * set if any worker fails, and with --stats the workers' statistics
+ * are collected and added together.
+ */
+static void dumpbatch(state const *s)
+{
+    pid_t *pids;
+    long *next;
+    int count, workers, status, fds[2], i;
+
+    if (mkdir(outputdir, 0777) && errno != EEXIST)
+        die("%s: %s", outputdir, strerror(errno));
+    if (colorize)
+        lookupterminal();
+    for (count = 0 ; s->filenames[count] ; ++count) ;
+    workers = threadcount < count ? threadcount : count;
+    next = mmap(NULL, sizeof *next, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    pids = malloc(workers * sizeof *pids);
+    if (next == MAP_FAILED || !pids)
+        die("out of memory");
+    *next = 0;
+    fds[0] = fds[1] = -1;
+    if (showstats && pipe2(fds, O_CLOEXEC))
+        die("unable to create pipe: %s", strerror(errno));
+    for (i = 0 ; i < workers ; ++i) {
+        pids[i] = fork();
+        if (pids[i] < 0)
+            die("unable to create process: %s", strerror(errno));
+        if (pids[i] == 0) {
+            batchworker(s, count, next, fds[1]);
+            exit(exitcode);
+        }
+    }
+    if (showstats) {
+        struct statistics part;
+
+        close(fds[1]);
+        memset(&stats, 0, sizeof stats);
+        while (read(fds[0], &part, sizeof part) == sizeof part) {
+            stats.inputbytes += part.inputbytes;
+            stats.outputbytes += part.outputbytes;
+            stats.linecount += part.linecount;
+            stats.elidedcount += part.elidedcount;
+            stats.readcalls += part.readcalls;
+            stats.writecalls += part.writecalls;
+            stats.inputtime += part.inputtime;
+            stats.rendertime += part.rendertime;
+            stats.outputtime += part.outputtime;
+        }
+        close(fds[0]);
+    }
+    for (i = 0 ; i < workers ; ++i)
+        if (waitpid(pids[i], &status, 0) < 0
+                    || !WIFEXITED(status) || WEXITSTATUS(status))
+            exitcode = EXIT_FAILURE;
+    free(pids);
+    munmap(next, sizeof *next);
+}
+
+
 /* Parse the command-line arguments and initialize the given state
  * appropriately, as well as default values. Invalid arguments (or
  * invalid combinations of arguments) will cause the program to exit.
@@ -819,38 +3521,123 @@ static void dump(state *s)
 static void parsecommandline(int argc, char *argv[], state *s)
 {
     static char *defaultargs[] = { "-", NULL };
-    static char const *optstring = "Aac:g:l:NRs:";
+    static char const *optstring = "Aac:Dfg:l:NRrs:z";
     static struct option options[] = {
         { "count", required_argument, NULL, 'c' },
         { "group", required_argument, NULL, 'g' },
         { "limit", required_argument, NULL, 'l' },
         { "start", required_argument, NULL, 's' },
         { "autoskip", no_argument, NULL, 'a' },
+        { "dedup", no_argument, NULL, 'D' },
+        { "follow", no_argument, NULL, 'f' },
+        { "decompress", no_argument, NULL, 'z' },
         { "no-color", no_argument, NULL, 'N' },
         { "raw", no_argument, NULL, 'R' },
+        { "reverse", no_argument, NULL, 'r' },
         { "ascii", no_argument, NULL, 'A' },
+        { "threads", required_argument, NULL, 't' },
+        { "pipeline", no_argument, NULL, 'P' },
+        { "no-cache", no_argument, NULL, 'K' },
+        { "stats", no_argument, NULL, 'S' },
+        { "tail", required_argument, NULL, 'T' },
+        { "pager", no_argument, NULL, 'V' },
+        { "diff", no_argument, NULL, 'd' },
+        { "range", required_argument, NULL, 'U' },
+        { "find", required_argument, NULL, 'F' },
+        { "find-text", required_argument, NULL, 'X' },
+        { "context", required_argument, NULL, 'C' },
+        { "overview", optional_argument, NULL, 'O' },
+        { "output-dir", required_argument, NULL, 'o' },
+        { "palette", required_argument, NULL, 'p' },
         { "help", no_argument, NULL, 'h' },
         { "version", no_argument, NULL, 'v' },
         { 0, 0, 0, 0 }
     };
 
+    int threadsgiven = 0;
     int ch;
 
     s->startoffset = 0;
-    s->maxinputlen = INT_MAX;
+    s->maxinputlen = MAXOFFSET;
     s->filenames = defaultargs;
-    s->currentfile = NULL;
+    s->currentfile = -1;
+    s->buf = NULL;
+    s->map = NULL;
+    s->data = NULL;
+    s->bufpos = 0;
+    s->bufcounted = 0;
+    s->buflen = 0;
+    s->nextfile = -1;
+    s->holecheck = 0;
+    s->silent = 0;
+    s->follow = 0;
+    s->watchfd = -1;
+    s->direct = 0;
+    s->decoder = NULL;
+    s->child = 0;
+    s->pending = 0;
+    s->linepos = 0;
+    s->linelen = 0;
+    s->shown = 0;
 
     while ((ch = getopt_long(argc, argv, optstring, options, NULL)) != EOF) {
         switch (ch) {
-          case 'l':     s->maxinputlen = getn(optarg, "limit", 0);  break;
-          case 's':     s->startoffset = getn(optarg, "start", 0);  break;
+          case 'l':     s->maxinputlen = getoffset(optarg, "limit"); break;
+          case 's':     s->startoffset = getoffset(optarg, "start"); break;
           case 'c':     linesize = getn(optarg, "count", 255);      break;
           case 'g':     groupsize = getn(optarg, "group", 0);       break;
           case 'a':     autoskip = 1;                               break;
+          case 'D':     dedup = 1;                                  break;
+          case 'f':     s->follow = 1;                              break;
+          case 'z':     decompress = 1;                             break;
           case 'N':     colorize = 0;                               break;
           case 'R':     hexoutput = 0;                              break;
+          case 'r':     reversemode = 1;                            break;
           case 'A':     useunicode = 0;                             break;
+          case 't':
+            threadcount = getn(optarg, "threads", 1024);
+            threadsgiven = 1;
+            break;
+          case 'P':     pipeline = 1;                               break;
+          case 'K':     nocache = 1;                                break;
+          case 'S':     showstats = 1;                              break;
+          case 'V':     pagermode = 1;                              break;
+          case 'd':     diffmode = 1;                               break;
+          case 'U':     getranges(optarg);                          break;
+          case 'C':     contextlines = getn(optarg, "context", 65536); break;
+          case 'F':     getpattern(optarg);                         break;
+          case 'O':
+            overview = 1;
+            if (optarg) {
+                overviewblock = getoffset(optarg, "overview");
+                if (!overviewblock || overviewblock > (off_t)1 << 30)
+                    die("invalid argument '%s' for overview", optarg);
+            }
+            break;
+          case 'o':
+            if (!*optarg)
+                die("missing argument for output-dir");
+            outputdir = optarg;
+            break;
+          case 'X':
+            if (!*optarg)
+                die("missing argument for find-text");
+            findpattern = (byte const*)optarg;
+            findlen = strlen(optarg);
+            break;
+          case 'T':
+            tailsize = getoffset(optarg, "tail");
+            if (!tailsize)
+                die("invalid argument '%s' for tail", optarg);
+            break;
+          case 'p':
+            if (!strcmp(optarg, "frequency"))
+                frequencypalette = 1;
+            else if (!strcmp(optarg, "first"))
+                frequencypalette = 0;
+            else
+                die("invalid argument '%s' for palette", optarg);
+            break;
           case 'h':     fputs(yowzitch, stdout);                    exit(0);
           case 'v':     fputs(vourzhon, stdout);                    exit(0);
           default:      die("Try --help for more information.");
@@ -858,18 +3645,116 @@ static void parsecommandline(int argc, char *argv[], state *s)
     }
     if (!hexoutput) {
         autoskip = 0;
+        dedup = 0;
         if (!colorize)
             die("cannot use both --raw and --no-color.");
     }
 
+    if (reversemode) {
+        if (!hexoutput || pagermode || diffmode || tailsize || findpattern
+                       || overview || rangecount || s->startoffset
+                       || s->maxinputlen != MAXOFFSET)
+            die("cannot use --reverse with options that select output.");
+        threadcount = 1;
+        pipeline = 0;
+    }
+
+    if (outputdir) {
+        if (pagermode || diffmode || tailsize || s->follow || reversemode)
+            die("cannot use --output-dir with --pager, --diff, --tail,"
+                " --follow, or --reverse.");
+        if (!threadsgiven)
+            threadcount = 0;
+    }
+
+    if (threadcount == 0) {
+        threadcount = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threadcount < 1)
+            threadcount = 1;
+    }
+    if (threadcount > 1)
+        pipeline = 1;
+    if (pagermode) {
+        if (!hexoutput)
+            die("cannot use both --pager and --raw.");
+        if (tailsize || s->follow)
+            die("cannot use --pager with --tail or --follow.");
+        autoskip = 0;
+        dedup = 0;
+        pipeline = 0;
+    }
+    if (diffmode) {
+        if (optind + 2 != argc)
+            die("--diff requires exactly two files.");
+        if (!hexoutput || pagermode || tailsize || s->follow)
+            die("cannot use --diff with --raw, --pager, --tail,"
+                " or --follow.");
+        autoskip = 0;
+        dedup = 0;
+        pipeline = 0;
+    }
+    if (rangecount) {
+        if (s->startoffset || s->maxinputlen != MAXOFFSET)
+            die("cannot use --range with --start or --limit.");
+        if (pagermode || diffmode || tailsize)
+            die("cannot use --range with --pager, --diff, or --tail.");
+        s->startoffset = ranges[0].start;
+        s->maxinputlen = ranges[rangecount - 1].end - ranges[0].start;
+    }
+    if (overview) {
+        if (!hexoutput || pagermode || diffmode || tailsize || findpattern
+                       || rangecount)
+            die("cannot use --overview with --raw, --pager, --diff, --tail,"
+                " --find, or --range.");
+        pipeline = 0;
+    }
+    if (findpattern) {
+        if (!hexoutput || pagermode || diffmode || tailsize)
+            die("cannot use --find with --raw, --pager, --diff, or --tail.");
+        autoskip = 0;
+        dedup = 0;
+    }
+
     if (linesize == 0)
         linesize = 16;
     if (groupsize == 0)
         groupsize = linesize;
-    hexwidth = 2 * linesize + (linesize + groupsize - 1) / groupsize;
 
     if (optind < argc)
         s->filenames = argv + optind;
+    if (outputdir) {
+        for (ch = 0 ; s->filenames[ch] ; ++ch)
+            if (!strcmp(s->filenames[ch], "-"))
+                die("--output-dir requires input files.");
+        pipeline = 0;
+    }
+}
+
+/* Display the statistics on the program's activity, given the total
+ * elapsed time. When the rendering is done on the main thread, its
+ * time is whatever is left over from getting input and writing it.
+ * In batch mode, the figures are the totals for all of the workers.
+ */
+static void reportstats(double elapsed)
+{
+    double rendertime;
+
+    rendertime = stats.rendertime;
+    if (!pipeline && !outputdir) {
+        rendertime = elapsed - stats.inputtime - stats.outputtime;
+        if (rendertime < 0)
+            rendertime = 0;
+    }
+    fprintf(stderr, "xcd: input: %lld bytes, %ld reads, %.3f s\n",
+            (long long)stats.inputbytes, stats.readcalls, stats.inputtime);
+    fprintf(stderr, "xcd: render: %lld lines, %lld elided, %.3f s\n",
+            (long long)stats.linecount, (long long)stats.elidedcount,
+            rendertime);
+    fprintf(stderr, "xcd: output: %lld bytes, %ld writes, %.3f s\n",
+            (long long)stats.outputbytes, stats.writecalls,
+            stats.outputtime);
+    fprintf(stderr, "xcd: total: %.3f s, %.1f MB/s\n", elapsed,
+            elapsed > 0 ? stats.inputbytes / elapsed / 1048576 : 0.0);
 }
 
 /* Main itself.
@@ -877,9 +3762,25 @@ static void parsecommandline(int argc, char *argv[], state *s)
 int main(int argc, char *argv[])
 {
     state s;
+    double t;
 
+    t = timenow();
     parsecommandline(argc, argv, &s);
-    initoutput();
-    dump(&s);
+    if (outputdir) {
+        initoutput();
+        dumpbatch(&s);
+    } else {
+        setaddresswidth(&s);
+        initoutput();
+        if (pipeline)
+            startworkers();
+        dump(&s);
+        countinput(&s);
+        if (pool.threads)
+            stopworkers();
+    }
+    flushoutput();
+    if (showstats)
+        reportstats(timenow() - t);
     return exitcode;
 }